@@ -0,0 +1,808 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+
+#include "cobuf.h"
+
+
+typedef struct __glove_co_zc_inflight {
+    list_t         node;
+    uint32_t       id;
+    co_buf_chain_t chain;
+} co_zc_inflight_t;
+
+
+static co_buf_t *co_buf_get(co_buf_pool_t *pool) {
+    co_buf_t *buf = (co_buf_t *)slab_alloc(&pool->bufs);
+    if (!buf) return 0;
+
+    buf->refcnt = 1;
+    buf->pool = pool;
+    return buf;
+}
+
+static void co_buf_put(co_buf_t *buf) {
+    if (--buf->refcnt == 0)
+        slab_free(&buf->pool->bufs, buf);
+}
+
+static co_buf_seg_t *co_buf_seg_get(co_buf_pool_t *pool) {
+    return (co_buf_seg_t *)slab_alloc(&pool->segs);
+}
+
+static void co_buf_seg_put(co_buf_pool_t *pool, co_buf_seg_t *seg) {
+    co_buf_put(seg->buf);
+    slab_free(&pool->segs, seg);
+}
+
+static co_buf_seg_t *co_buf_chain_tail(co_buf_chain_t *chain) {
+    if (list_empty(&chain->segs)) return 0;
+    return container_of(chain->segs.prev, co_buf_seg_t, node);
+}
+
+// free room behind the tail, only when no other chain can see that buffer
+static size_t co_buf_chain_room(co_buf_chain_t *chain) {
+    co_buf_seg_t *tail = co_buf_chain_tail(chain);
+    if (!tail || tail->buf->refcnt != 1) return 0;
+    return CO_BUF_SIZE - tail->off - tail->len;
+}
+
+// keep the first `len` bytes only
+static void co_buf_chain_truncate(co_buf_chain_t *chain, size_t len) {
+    while (chain->length > len) {
+        co_buf_seg_t *tail = co_buf_chain_tail(chain);
+        size_t drop = chain->length - len;
+        if (drop < tail->len) {
+            tail->len -= drop;
+            chain->length -= drop;
+        } else {
+            chain->length -= tail->len;
+            list_del(&tail->node);
+            co_buf_seg_put(chain->pool, tail);
+        }
+    }
+}
+
+// one iovec per segment from the head, at most CO_BUF_IOV of them
+static int co_buf_chain_iov(co_buf_chain_t *chain, struct iovec *iov) {
+    int niov = 0;
+    for (list_t *node = list_get_head(&chain->segs); node != &chain->segs && niov < CO_BUF_IOV; node = node->next) {
+        co_buf_seg_t *seg = container_of(node, co_buf_seg_t, node);
+        iov[niov].iov_base = seg->buf->data + seg->off;
+        iov[niov].iov_len = seg->len;
+        niov++;
+    }
+    return niov;
+}
+
+// splice and tee can not tell which side would block
+static int co_buf_wait_pair(co_routine_t *co_routine, int fd_in, int fd_out) {
+    struct pollfd pollfd = {.fd = fd_out, .events = POLLOUT, .revents = 0};
+    if (poll(&pollfd, 1, 0) == 0)
+        return co_wait_fd(co_routine, fd_out, EPOLLOUT, 0);
+    return co_wait_fd(co_routine, fd_in, EPOLLIN, 0);
+}
+
+
+static void co_buf_pool_adopt(co_attached_t *co_attached) {
+    co_buf_pool_t *pool = container_of(co_attached, co_buf_pool_t, co_attached);
+    slab_adopt(&pool->bufs);
+    slab_adopt(&pool->segs);
+    slab_adopt(&pool->inflight);
+}
+
+
+// may be called before co_scheduler is run on another thread,
+// the pool follows it there
+co_buf_pool_t *co_buf_pool_init(co_buf_pool_t *pool, co_scheduler_t *co_scheduler) {
+    slab_init(&pool->bufs, sizeof(co_buf_t), CO_BUF_SLAB);
+    slab_init(&pool->segs, sizeof(co_buf_seg_t), CO_BUF_SLAB * 4);
+    slab_init(&pool->inflight, sizeof(co_zc_inflight_t), CO_BUF_SLAB);
+
+    pool->co_scheduler = co_scheduler;
+    pool->co_attached.adopt = co_buf_pool_adopt;
+    co_scheduler_attach(co_scheduler, &pool->co_attached);
+    return pool;
+}
+
+void co_buf_pool_destroy(co_buf_pool_t *pool) {
+    // every chain of this pool must have been destroyed
+    co_scheduler_detach(&pool->co_attached);
+    slab_destroy(&pool->bufs);
+    slab_destroy(&pool->segs);
+    slab_destroy(&pool->inflight);
+}
+
+
+co_buf_chain_t *co_buf_chain_init(co_buf_chain_t *chain, co_buf_pool_t *pool) {
+    list_init(&chain->segs);
+    chain->length = 0;
+    chain->pool = pool;
+    return chain;
+}
+
+void co_buf_chain_destroy(co_buf_chain_t *chain) {
+    co_buf_chain_consume(chain, chain->length);
+    list_destroy(&chain->segs);
+}
+
+int co_buf_chain_append(co_buf_chain_t *chain, const void *data, size_t len) {
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    while (len > 0) {
+        size_t room = co_buf_chain_room(chain);
+        if (!room) {
+            co_buf_seg_t *seg = co_buf_seg_get(chain->pool);
+            if (!seg) return ENOMEM;
+            seg->buf = co_buf_get(chain->pool);
+            if (!seg->buf) {
+                slab_free(&chain->pool->segs, seg);
+                return ENOMEM;
+            }
+            seg->off = 0;
+            seg->len = 0;
+            list_add_tail(&chain->segs, &seg->node);
+            continue;
+        }
+
+        co_buf_seg_t *tail = co_buf_chain_tail(chain);
+        size_t n = len < room ? len : room;
+        memcpy(tail->buf->data + tail->off + tail->len, bytes, n);
+        tail->len += n;
+        chain->length += n;
+        bytes += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+// append the first `len` bytes of src to dst by reference, src is unchanged,
+// EXDEV across pools, copy with co_buf_chain_copyout then
+int co_buf_chain_share(co_buf_chain_t *dst, co_buf_chain_t *src, size_t len) {
+    if (len > src->length || dst == src) return EINVAL;
+    if (dst->pool != src->pool) return EXDEV;
+
+    for (list_t *node = list_get_head(&src->segs); len > 0; node = node->next) {
+        co_buf_seg_t *seg = container_of(node, co_buf_seg_t, node);
+
+        co_buf_seg_t *share = co_buf_seg_get(dst->pool);
+        if (!share) return ENOMEM;
+        share->buf = seg->buf;
+        share->buf->refcnt++;
+        share->off = seg->off;
+        share->len = len < seg->len ? len : seg->len;
+        list_add_tail(&dst->segs, &share->node);
+
+        dst->length += share->len;
+        len -= share->len;
+    }
+
+    return 0;
+}
+
+void co_buf_chain_consume(co_buf_chain_t *chain, size_t len) {
+    while (len > 0 && !list_empty(&chain->segs)) {
+        co_buf_seg_t *seg = container_of(list_get_head(&chain->segs), co_buf_seg_t, node);
+        if (len < seg->len) {
+            seg->off += len;
+            seg->len -= len;
+            chain->length -= len;
+            return;
+        }
+
+        len -= seg->len;
+        chain->length -= seg->len;
+        list_del(&seg->node);
+        co_buf_seg_put(chain->pool, seg);
+    }
+}
+
+size_t co_buf_chain_copyout(co_buf_chain_t *chain, void *data, size_t len) {
+    unsigned char *bytes = (unsigned char *)data;
+    size_t copied = 0;
+
+    for (list_t *node = list_get_head(&chain->segs); node != &chain->segs && copied < len; node = node->next) {
+        co_buf_seg_t *seg = container_of(node, co_buf_seg_t, node);
+        size_t n = len - copied < seg->len ? len - copied : seg->len;
+        memcpy(bytes + copied, seg->buf->data + seg->off, n);
+        copied += n;
+    }
+
+    return copied;
+}
+
+
+// read up to `max` bytes, straight into the buffers of the chain
+ssize_t co_buf_chain_readv(co_routine_t *co_routine, co_buf_chain_t *chain, int fd, size_t max) {
+    struct iovec iov[CO_BUF_IOV];
+    co_buf_seg_t *fresh[CO_BUF_IOV];
+    int niov = 0, nfresh = 0;
+
+    size_t room = co_buf_chain_room(chain);
+    if (room > max) room = max;
+    if (room) {
+        co_buf_seg_t *tail = co_buf_chain_tail(chain);
+        iov[niov].iov_base = tail->buf->data + tail->off + tail->len;
+        iov[niov].iov_len = room;
+        niov++;
+    }
+
+    // everything that may be filled is taken before reading,
+    // so no allocation can fail once bytes are consumed from fd
+    size_t want = max - room;
+    while (want > 0 && niov < CO_BUF_IOV) {
+        co_buf_seg_t *seg = co_buf_seg_get(chain->pool);
+        if (!seg) break;
+        seg->buf = co_buf_get(chain->pool);
+        if (!seg->buf) {
+            slab_free(&chain->pool->segs, seg);
+            break;
+        }
+        seg->off = 0;
+        seg->len = 0;
+        fresh[nfresh++] = seg;
+
+        iov[niov].iov_base = seg->buf->data;
+        iov[niov].iov_len = want < CO_BUF_SIZE ? want : CO_BUF_SIZE;
+        want -= iov[niov].iov_len;
+        niov++;
+    }
+    if (!niov) {
+        errno = max ? ENOMEM : EINVAL;
+        return -1;
+    }
+
+    ssize_t n;
+    while ((n = readv(fd, iov, niov)) == -1) {
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) break;
+
+        int ret = co_wait_fd(co_routine, fd, EPOLLIN, 0);
+        if (ret) {
+            errno = ret;
+            break;
+        }
+    }
+
+    size_t left = n > 0 ? (size_t)n : 0;
+    if (room) {
+        size_t filled = left < room ? left : room;
+        co_buf_chain_tail(chain)->len += filled;
+        chain->length += filled;
+        left -= filled;
+    }
+    for (int i = 0; i < nfresh; i++) {
+        if (!left) {
+            co_buf_seg_put(chain->pool, fresh[i]);
+            continue;
+        }
+        fresh[i]->len = left < CO_BUF_SIZE ? left : CO_BUF_SIZE;
+        list_add_tail(&chain->segs, &fresh[i]->node);
+        chain->length += fresh[i]->len;
+        left -= fresh[i]->len;
+    }
+
+    return n;
+}
+
+// write and consume the whole chain
+ssize_t co_buf_chain_writev(co_routine_t *co_routine, co_buf_chain_t *chain, int fd) {
+    struct iovec iov[CO_BUF_IOV];
+    ssize_t total = 0;
+
+    while (chain->length > 0) {
+        int niov = co_buf_chain_iov(chain, iov);
+        ssize_t n = writev(fd, iov, niov);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) return -1;
+
+            int ret = co_wait_fd(co_routine, fd, EPOLLOUT, 0);
+            if (ret) {
+                errno = ret;
+                return -1;
+            }
+            continue;
+        }
+
+        co_buf_chain_consume(chain, n);
+        total += n;
+    }
+
+    return total;
+}
+
+// one side must be a pipe, bytes never enter user space
+ssize_t co_splice(co_routine_t *co_routine, int fd_in, int fd_out, size_t len) {
+    while (1) {
+        ssize_t n = splice(fd_in, 0, fd_out, 0, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n >= 0) return n;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) return -1;
+
+        int ret = co_buf_wait_pair(co_routine, fd_in, fd_out);
+        if (ret) {
+            errno = ret;
+            return -1;
+        }
+    }
+}
+
+// duplicate without consuming, both ends must be pipes
+ssize_t co_tee(co_routine_t *co_routine, int pipe_in, int pipe_out, size_t len) {
+    while (1) {
+        ssize_t n = tee(pipe_in, pipe_out, len, SPLICE_F_NONBLOCK);
+        if (n >= 0) return n;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) return -1;
+
+        int ret = co_buf_wait_pair(co_routine, pipe_in, pipe_out);
+        if (ret) {
+            errno = ret;
+            return -1;
+        }
+    }
+}
+
+
+// release the buffers of every completed send, 0 once the error queue is empty
+static int co_zc_drain(co_zc_t *co_zc) {
+    while (1) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(co_zc->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return 0;
+            return -1;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+
+            struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+                continue;
+
+            // ids [ee_info, ee_data] completed, the range may wrap
+            uint32_t lo = serr->ee_info, hi = serr->ee_data;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                co_zc->copied += hi - lo + 1;
+
+            list_t *node = list_get_head(&co_zc->inflight);
+            while (node != &co_zc->inflight) {
+                co_zc_inflight_t *inflight = container_of(node, co_zc_inflight_t, node);
+                node = node->next;
+                if ((uint32_t)(inflight->id - lo) > (uint32_t)(hi - lo)) continue;
+
+                list_del(&inflight->node);
+                co_buf_chain_destroy(&inflight->chain);
+                slab_free(&co_zc->pool->inflight, inflight);
+                co_zc->completed++;
+            }
+        }
+    }
+}
+
+// completions raise EPOLLERR, left in the error queue it would stay raised
+static void co_zc_callback(co_event_listener_t *co_event_listener) {
+    co_zc_t *co_zc = container_of(co_event_listener, co_zc_t, co_event_listener);
+
+    int64_t completed = co_zc->completed;
+    co_zc_drain(co_zc);
+    if (co_zc->co_reaper && co_zc->completed != completed)
+        co_resume(co_zc->co_reaper);
+}
+
+static void co_zc_reap_cancel(co_routine_t *co_routine, void *co_wait) {
+    ((co_zc_t *)co_wait)->co_reaper = 0;
+}
+
+
+// completions are drained by the scheduler of `pool` from now on
+co_zc_t *co_zc_init(co_zc_t *co_zc, int fd, co_buf_pool_t *pool) {
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == -1)
+        return 0;
+
+    co_zc->fd = fd;
+    co_zc->next_id = 0;
+    list_init(&co_zc->inflight);
+    co_zc->copied = 0;
+    co_zc->completed = 0;
+    co_zc->pool = pool;
+    co_zc->co_reaper = 0;
+    co_zc->co_event_listener.callback = co_zc_callback;
+    int ret = co_fd_watch_error(pool->co_scheduler, fd, &co_zc->co_event_listener);
+    if (ret) {
+        errno = ret;
+        return 0;
+    }
+    return co_zc;
+}
+
+// the socket must be closed or every send reaped, or the kernel may
+// still read buffers released here
+void co_zc_destroy(co_zc_t *co_zc) {
+    co_fd_unwatch(co_zc->pool->co_scheduler, co_zc->fd, &co_zc->co_event_listener);
+    while (!list_empty(&co_zc->inflight)) {
+        co_zc_inflight_t *inflight = container_of(list_del(list_get_head(&co_zc->inflight)), co_zc_inflight_t, node);
+        co_buf_chain_destroy(&inflight->chain);
+        slab_free(&co_zc->pool->inflight, inflight);
+    }
+    list_destroy(&co_zc->inflight);
+}
+
+// send and consume the whole chain, sent buffers stay referenced until reaped
+ssize_t co_zc_send(co_routine_t *co_routine, co_zc_t *co_zc, co_buf_chain_t *chain) {
+    struct iovec iov[CO_BUF_IOV];
+    ssize_t total = 0;
+
+    while (chain->length > 0) {
+        int niov = co_buf_chain_iov(chain, iov);
+        size_t len = 0;
+        for (int i = 0; i < niov; i++) len += iov[i].iov_len;
+
+        // hold the references before the kernel can pin the pages
+        co_zc_inflight_t *inflight = (co_zc_inflight_t *)slab_alloc(&co_zc->pool->inflight);
+        if (!inflight) {
+            errno = ENOMEM;
+            return -1;
+        }
+        co_buf_chain_init(&inflight->chain, co_zc->pool);
+        int ret = co_buf_chain_share(&inflight->chain, chain, len);
+        if (ret) {
+            co_buf_chain_destroy(&inflight->chain);
+            slab_free(&co_zc->pool->inflight, inflight);
+            errno = ret;
+            return -1;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = niov;
+        ssize_t n = sendmsg(co_zc->fd, &msg, MSG_ZEROCOPY | MSG_DONTWAIT);
+        if (n == -1) {
+            int error = errno;
+            co_buf_chain_destroy(&inflight->chain);
+            slab_free(&co_zc->pool->inflight, inflight);
+
+            if (error == EINTR) continue;
+            if (error == ENOBUFS) {
+                // too much pinned memory, nothing of ours to wait for
+                // when none is in flight, so retrying would only spin
+                if (list_empty(&co_zc->inflight)) {
+                    errno = ENOBUFS;
+                    return -1;
+                }
+                if (co_zc_reap(co_routine, co_zc, 1) == -1) return -1;
+                continue;
+            }
+            if (error != EAGAIN) {
+                errno = error;
+                return -1;
+            }
+
+            co_zc_reap(co_routine, co_zc, 0);
+            ret = co_wait_fd(co_routine, co_zc->fd, EPOLLOUT, 0);
+            if (ret) {
+                errno = ret;
+                return -1;
+            }
+            continue;
+        }
+
+        co_buf_chain_truncate(&inflight->chain, n);
+        inflight->id = co_zc->next_id++;
+        list_add_tail(&co_zc->inflight, &inflight->node);
+
+        co_buf_chain_consume(chain, n);
+        total += n;
+    }
+
+    return total;
+}
+
+// release the buffers of completed sends, returns how many sends completed
+// since the call, kloopd may already have released some of them before;
+// with `wait` the co_routine is parked until at least one completes
+int co_zc_reap(co_routine_t *co_routine, co_zc_t *co_zc, int wait) {
+    int64_t completed = co_zc->completed;
+    if (co_zc_drain(co_zc) == -1) return -1;
+
+    while (wait && co_zc->completed == completed && !list_empty(&co_zc->inflight)) {
+        co_zc->co_reaper = co_routine;
+        co_routine->co_wait_cancel = co_zc_reap_cancel;
+        co_routine->co_wait = co_zc;
+        int status = co_yield(co_routine);
+        co_routine->co_wait_cancel = 0;
+        co_zc->co_reaper = 0;
+        if (status) {
+            errno = status;
+            return -1;
+        }
+    }
+    return co_zc->completed - completed;
+}
+
+
+/** BEGIN: unit test **/
+#ifdef __MODULE_COBUF__
+// gcc -g -Wall -fsanitize=address -D__MODULE_COBUF__ cobuf.c coroutine.c utils/slab.c
+
+#include <stdio.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/timerfd.h>
+
+static co_buf_pool_t pool;
+
+static void test_vectored(co_routine_t *co_uinit) {
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv);
+
+    co_buf_chain_t out, copy, in;
+    co_buf_chain_init(&out, &pool);
+    co_buf_chain_init(&copy, &pool);
+    co_buf_chain_init(&in, &pool);
+
+    // spans a couple of buffers
+    char line[100];
+    for (int i = 0; i < 400; i++) {
+        int n = snprintf(line, sizeof(line), "line %03d\n", i);
+        co_buf_chain_append(&out, line, n);
+    }
+    co_buf_chain_share(&copy, &out, out.length);
+    printf("[%s] out length %lu, shared copy length %lu\n", __FUNCTION__, out.length, copy.length);
+
+    ssize_t written = co_buf_chain_writev(co_uinit, &out, sv[0]);
+    ssize_t received = 0;
+    while (received < written) {
+        ssize_t n = co_buf_chain_readv(co_uinit, &in, sv[1], 64 * 1024);
+        if (n <= 0) break;
+        received += n;
+    }
+
+    char first[9] = {0}, last[9] = {0};
+    co_buf_chain_copyout(&in, first, 8);
+    co_buf_chain_consume(&in, in.length - 9);
+    co_buf_chain_copyout(&in, last, 8);
+    printf("[%s] written %ld, received %ld, first \"%s\", last \"%s\", copy length %lu\n",
+           __FUNCTION__, written, received, first, last, copy.length);
+
+    co_buf_chain_destroy(&out);
+    co_buf_chain_destroy(&copy);
+    co_buf_chain_destroy(&in);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+#define DUPLEX_BYTES (1024 * 1024)
+
+static int duplex[2];
+static ssize_t duplex_replied = 0;
+static int duplex_done = 0;
+
+// parked reading duplex[0] while the writer of the same socket blocks on it
+void duplex_reader(int ptr_high_bits, int ptr_low_bits) {
+    co_routine_t *co_reader = co_this(ptr_high_bits, ptr_low_bits);
+    co_buf_chain_t reply;
+    co_buf_chain_init(&reply, &pool);
+    duplex_replied = co_buf_chain_readv(co_reader, &reply, duplex[0], 64);
+    co_buf_chain_destroy(&reply);
+    duplex_done++;
+}
+
+// drains duplex[1], then replies
+void duplex_peer(int ptr_high_bits, int ptr_low_bits) {
+    co_routine_t *co_peer = co_this(ptr_high_bits, ptr_low_bits);
+    co_buf_chain_t in;
+    co_buf_chain_init(&in, &pool);
+    size_t received = 0;
+    while (received < DUPLEX_BYTES) {
+        ssize_t n = co_buf_chain_readv(co_peer, &in, duplex[1], 64 * 1024);
+        if (n <= 0) break;
+        received += n;
+        co_buf_chain_consume(&in, in.length);
+    }
+    co_buf_chain_append(&in, "done", 4);
+    co_buf_chain_writev(co_peer, &in, duplex[1]);
+    co_buf_chain_destroy(&in);
+    duplex_done++;
+}
+
+static void test_duplex(co_routine_t *co_uinit) {
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, duplex);
+    co_routine_t *co_reader = co_create(co_uinit->co_scheduler, duplex_reader);
+    co_routine_t *co_peer = co_create(co_uinit->co_scheduler, duplex_peer);
+
+    // let the reader park first
+    co_resume(co_uinit);
+    co_yield(co_uinit);
+
+    co_buf_chain_t out;
+    co_buf_chain_init(&out, &pool);
+    static char payload[DUPLEX_BYTES];
+    co_buf_chain_append(&out, payload, sizeof(payload));
+    ssize_t written = co_buf_chain_writev(co_uinit, &out, duplex[0]);
+    co_buf_chain_destroy(&out);
+
+    while (duplex_done < 2) {
+        co_resume(co_uinit);
+        co_yield(co_uinit);
+    }
+    printf("[%s] written %ld while a reader waited on the same socket, reply %ld\n",
+           __FUNCTION__, written, duplex_replied);
+
+    co_release(co_reader);
+    co_release(co_peer);
+    close(duplex[0]);
+    close(duplex[1]);
+}
+
+static void test_splice(co_routine_t *co_uinit) {
+    int src[2], dst[2], dup[2], pipefd[2], pipedup[2];
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, src);
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, dst);
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, dup);
+    pipe2(pipefd, O_NONBLOCK | O_CLOEXEC);
+    pipe2(pipedup, O_NONBLOCK | O_CLOEXEC);
+
+    const char message[] = "forwarded without a copy";
+    write(src[0], message, sizeof(message));
+
+    // src -> pipe, tee pipe -> pipedup, pipe -> dst, pipedup -> dup
+    ssize_t in = co_splice(co_uinit, src[1], pipefd[1], 4096);
+    ssize_t teed = co_tee(co_uinit, pipefd[0], pipedup[1], 4096);
+    ssize_t out = co_splice(co_uinit, pipefd[0], dst[0], 4096);
+    ssize_t dupped = co_splice(co_uinit, pipedup[0], dup[0], 4096);
+
+    char received[64] = {0}, duplicated[64] = {0};
+    read(dst[1], received, sizeof(received));
+    read(dup[1], duplicated, sizeof(duplicated));
+    printf("[%s] spliced %ld/%ld, teed %ld/%ld: \"%s\", \"%s\"\n",
+           __FUNCTION__, in, out, teed, dupped, received, duplicated);
+
+    int fds[] = {src[0], src[1], dst[0], dst[1], dup[0], dup[1], pipefd[0], pipefd[1], pipedup[0], pipedup[1]};
+    for (int i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) close(fds[i]);
+}
+
+static int zc_reader_fd;
+static uint32_t zc_reader_revents;
+
+// parked on the zerocopy socket, only data may wake it
+static void zc_reader(int ptr_high_bits, int ptr_low_bits) {
+    co_routine_t *co_reader = co_this(ptr_high_bits, ptr_low_bits);
+    co_wait_fd(co_reader, zc_reader_fd, EPOLLIN, &zc_reader_revents);
+}
+
+static int64_t cpu_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void test_zerocopy(co_routine_t *co_uinit) {
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    bind(listenfd, (struct sockaddr *)&addr, sizeof(addr));
+    listen(listenfd, 1);
+    getsockname(listenfd, (struct sockaddr *)&addr, &addrlen);
+
+    int client = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    connect(client, (struct sockaddr *)&addr, sizeof(addr));
+    co_wait_fd(co_uinit, listenfd, EPOLLIN, 0);
+    int server = accept4(listenfd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    co_wait_fd(co_uinit, client, EPOLLOUT, 0);
+
+    co_zc_t co_zc;
+    if (!co_zc_init(&co_zc, client, &pool)) {
+        printf("[%s] SO_ZEROCOPY unsupported: %s\n", __FUNCTION__, strerror(errno));
+        goto done;
+    }
+
+    co_buf_chain_t out, in;
+    co_buf_chain_init(&out, &pool);
+    co_buf_chain_init(&in, &pool);
+    static char payload[3 * CO_BUF_SIZE];
+    memset(payload, 'z', sizeof(payload));
+    co_buf_chain_append(&out, payload, sizeof(payload));
+
+    zc_reader_fd = client;
+    co_routine_t *co_reader = co_create(co_uinit->co_scheduler, zc_reader);
+    co_resume(co_uinit);
+    co_yield(co_uinit);
+
+    ssize_t sent = co_zc_send(co_uinit, &co_zc, &out);
+    ssize_t received = 0;
+    while (received < sent) {
+        ssize_t n = co_buf_chain_readv(co_uinit, &in, server, sizeof(payload));
+        if (n <= 0) break;
+        received += n;
+    }
+
+    // nothing reaps meanwhile, the completions neither woke the reader
+    // nor kept kloopd spinning, it drained them itself
+    int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec spec = {.it_interval = {0, 0}, .it_value = {0, 100 * 1000000}};
+    timerfd_settime(timerfd, 0, &spec, 0);
+    int64_t idle_us = cpu_us();
+    co_wait_fd(co_uinit, timerfd, EPOLLIN, 0);
+    idle_us = cpu_us() - idle_us;
+    close(timerfd);
+    printf("[%s] reader woken: %d, busy while idle: %d\n",
+           __FUNCTION__, zc_reader_revents != 0, idle_us > 50000);
+
+    while (!list_empty(&co_zc.inflight))
+        if (co_zc_reap(co_uinit, &co_zc, 1) < 0) break;
+    // loopback always falls back to copying, but still completes
+    printf("[%s] sent %ld, received %ld, completed %ld sends, %ld copied\n",
+           __FUNCTION__, sent, received, co_zc.completed, co_zc.copied);
+    write(server, "x", 1);
+    while (!zc_reader_revents) {
+        co_resume(co_uinit);
+        co_yield(co_uinit);
+    }
+    printf("[%s] reader woken by data, EPOLLERR: %d\n",
+           __FUNCTION__, (zc_reader_revents & EPOLLERR) != 0);
+    co_release(co_reader);
+
+    co_buf_chain_destroy(&out);
+    co_buf_chain_destroy(&in);
+    co_zc_destroy(&co_zc);
+
+done:
+    close(client);
+    close(server);
+    close(listenfd);
+}
+
+void init(int ptr_high_bits, int ptr_low_bits) {
+    co_routine_t *co_uinit = co_this(ptr_high_bits, ptr_low_bits);
+    printf("[%s] enter\n", __FUNCTION__);
+
+    printf("[%s] pool adopted: %d\n", __FUNCTION__, pool.bufs.owner == &slab_thread_token);
+    test_vectored(co_uinit);
+    test_duplex(co_uinit);
+    test_splice(co_uinit);
+    test_zerocopy(co_uinit);
+    co_buf_pool_destroy(&pool);
+
+    co_scheduler_exit(co_uinit->co_scheduler);
+    printf("[%s] return\n", __FUNCTION__);
+}
+
+int main(int argc, char *argv[]) {
+    co_scheduler_t *co_scheduler = malloc(sizeof(co_scheduler_t));
+    co_scheduler_init(co_scheduler, init);
+    // adopted by the thread running co_scheduler, remote frees otherwise
+    co_buf_pool_init(&pool, co_scheduler);
+    co_scheduler_run(co_scheduler);
+    free(co_scheduler);
+    return 0;
+}
+
+#endif
+/** END: unit test **/
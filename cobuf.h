@@ -0,0 +1,103 @@
+#ifndef __HEADER_GLOVE_COBUF__
+#define __HEADER_GLOVE_COBUF__
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "coroutine.h"
+#include "utils/list.h"
+#include "utils/slab.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define CO_BUF_SIZE (16 * 1024)
+// objects carved out of one malloc when a slab runs dry
+#define CO_BUF_SLAB 32
+// most buffers filled by one readv or sent by one sendmsg
+#define CO_BUF_IOV  16
+
+
+struct __glove_co_buf_pool;
+
+// refcounted payload, shared by every co_buf_seg_t pointing into it
+typedef struct __glove_co_buf {
+    int                         refcnt;
+    struct __glove_co_buf_pool *pool;
+    unsigned char               data[CO_BUF_SIZE];
+} co_buf_t;
+
+// a slice of a co_buf_t, linked into a chain
+typedef struct __glove_co_buf_seg {
+    list_t    node;
+    co_buf_t *buf;
+    uint32_t  off;
+    uint32_t  len;
+} co_buf_seg_t;
+
+// one per scheduler, used only by the thread running it; co_buf_chain_share
+// never lets a co_buf_t into a chain of another pool, so refcounts need no atomics
+typedef struct __glove_co_buf_pool {
+    slab_t          bufs;
+    slab_t          segs;
+    slab_t          inflight;
+    // the slabs are adopted by co_scheduler_run along with the scheduler's own
+    co_attached_t   co_attached;
+    co_scheduler_t *co_scheduler;
+} co_buf_pool_t;
+
+typedef struct __glove_co_buf_chain {
+    list_t         segs;
+    size_t         length;
+    co_buf_pool_t *pool;
+} co_buf_chain_t;
+
+// MSG_ZEROCOPY sender, keeps sent buffers alive until the kernel is done
+typedef struct __glove_co_zc {
+    int                 fd;
+    // id the kernel gives the next zerocopy sendmsg
+    uint32_t            next_id;
+    list_t              inflight;
+    int64_t             copied;
+    // sends reaped so far, kloopd drains completions as they come
+    int64_t             completed;
+    co_buf_pool_t      *pool;
+    co_event_listener_t co_event_listener;
+    // parked in co_zc_reap until a completion comes
+    co_routine_t       *co_reaper;
+} co_zc_t;
+
+
+co_buf_pool_t *co_buf_pool_init(co_buf_pool_t *pool, co_scheduler_t *co_scheduler);
+void co_buf_pool_destroy(co_buf_pool_t *pool);
+
+co_buf_chain_t *co_buf_chain_init(co_buf_chain_t *chain, co_buf_pool_t *pool);
+void co_buf_chain_destroy(co_buf_chain_t *chain);
+int co_buf_chain_append(co_buf_chain_t *chain, const void *data, size_t len);
+int co_buf_chain_share(co_buf_chain_t *dst, co_buf_chain_t *src, size_t len);
+void co_buf_chain_consume(co_buf_chain_t *chain, size_t len);
+size_t co_buf_chain_copyout(co_buf_chain_t *chain, void *data, size_t len);
+
+// fds must be O_NONBLOCK, co_routine is parked on readiness instead
+ssize_t co_buf_chain_readv(co_routine_t *co_routine, co_buf_chain_t *chain, int fd, size_t max);
+ssize_t co_buf_chain_writev(co_routine_t *co_routine, co_buf_chain_t *chain, int fd);
+ssize_t co_splice(co_routine_t *co_routine, int fd_in, int fd_out, size_t len);
+ssize_t co_tee(co_routine_t *co_routine, int pipe_in, int pipe_out, size_t len);
+
+co_zc_t *co_zc_init(co_zc_t *co_zc, int fd, co_buf_pool_t *pool);
+void co_zc_destroy(co_zc_t *co_zc);
+ssize_t co_zc_send(co_routine_t *co_routine, co_zc_t *co_zc, co_buf_chain_t *chain);
+int co_zc_reap(co_routine_t *co_routine, co_zc_t *co_zc, int wait);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -8,46 +8,69 @@
 #include "cocv.h"
 
 
+// waiters and timeouts come from the scheduler's co_object_slab
+_Static_assert(sizeof(co_cv_waiter_t) <= CO_OBJECT_SIZE, "co_cv_waiter_t outgrew CO_OBJECT_SIZE");
+_Static_assert(sizeof(co_cv_timeout_t) <= CO_OBJECT_SIZE, "co_cv_timeout_t outgrew CO_OBJECT_SIZE");
+
+
 static void co_cv_eventfd_callback(co_event_listener_t *co_event_listener) {
     co_cv_t *co_cv = container_of(co_event_listener, co_cv_t, co_event_listener);
 
     int64_t count = 0;
     read(co_cv->eventfd, &count, sizeof(count));
-    while (count-- > 0 && !list_empty(&co_cv->cv_waiters)) {
-        list_t *node = list_get_head(&co_cv->cv_waiters);
+    int64_t now_us = co_clock_us();
+    list_t *node = list_get_head(&co_cv->cv_waiters);
+    while (count > 0 && node != &co_cv->cv_waiters) {
         co_cv_waiter_t *co_cv_waiter = container_of(node, co_cv_waiter_t, node);
+        node = node->next;
+
+        if (co_cv_waiter->co_waker) {
+            // only defers the wakeup, the list is left alone
+            co_event_listener_t *co_waker = co_cv_waiter->co_waker;
+            list_init(list_del(&co_cv_waiter->node));
+            co_waker->callback(co_waker);
+            count--;
+            continue;
+        }
 
+        // kloopd sheds it anyway, so the wakeup goes to the next waiter
         co_routine_t *co_routine = co_cv_waiter->co_routine;
-        if (co_cv_waiter->co_cv_timeout) {
-            // notify the waiting co_routine
-            *co_cv_waiter->co_cv_timeout->valid = 0;
-            // set timeout invalid
+        if (co_routine->co_deadline_us && co_routine->co_deadline_us <= now_us)
+            continue;
+
+        // notify the waiting co_routine
+        *co_cv_waiter->woken = 1;
+        // set timeout invalid
+        if (co_cv_waiter->co_cv_timeout)
             co_cv_waiter->co_cv_timeout->valid = 0;
-        }
 
-        list_del(node);
-        free(co_cv_waiter);
+        list_del(&co_cv_waiter->node);
+        slab_free(&co_cv->co_scheduler->co_object_slab, co_cv_waiter);
 
         co_resume(co_routine);
+        count--;
     }
 }
 
 static void co_cv_timerfd_callback(co_event_listener_t *co_event_listener) {
     co_cv_timeout_t *co_cv_timeout = container_of(co_event_listener, co_cv_timeout_t, co_event_listener);
-    co_cv_waiter_t *co_cv_waiter = container_of(co_cv_timeout->node, co_cv_waiter_t, node);
-    co_routine_t *co_routine = co_cv_waiter->co_routine;
+    co_scheduler_t *co_scheduler = co_cv_timeout->co_scheduler;
 
-    epoll_ctl(co_routine->co_scheduler->epollfd, EPOLL_CTL_DEL, co_cv_timeout->timerfd, 0);
+    epoll_ctl(co_scheduler->epollfd, EPOLL_CTL_DEL, co_cv_timeout->timerfd, 0);
     close(co_cv_timeout->timerfd);
 
     if (co_cv_timeout->valid) {
+        co_cv_waiter_t *co_cv_waiter = container_of(co_cv_timeout->node, co_cv_waiter_t, node);
+        co_routine_t *co_routine = co_cv_waiter->co_routine;
+        *co_cv_timeout->valid = 1;
+
         list_del(&co_cv_waiter->node);
-        free(co_cv_waiter);
-        free(co_cv_timeout);
+        slab_free(&co_scheduler->co_object_slab, co_cv_waiter);
+        slab_free(&co_scheduler->co_object_slab, co_cv_timeout);
 
         co_resume(co_routine);
     } else {
-        free(co_cv_timeout);
+        slab_free(&co_scheduler->co_object_slab, co_cv_timeout);
     }
 }
 
@@ -57,7 +80,7 @@ co_cv_t *co_cv_init(co_cv_t *co_cv, co_scheduler_t *co_scheduler) {
     if (co_cv->eventfd == -1) goto error_cv_id;
 
     struct epoll_event read_event;
-    read_event.events = EPOLLIN;  // | EPOLLET;
+    read_event.events = EPOLLIN | co_scheduler->co_epoll_flags;
     read_event.data.ptr = &co_cv->co_event_listener;
     int ret = epoll_ctl(co_scheduler->epollfd, EPOLL_CTL_ADD, co_cv->eventfd, &read_event);
     if (ret == -1) goto error_event_callback;
@@ -86,26 +109,70 @@ void co_cv_destroy(co_cv_t *co_cv) {
         // we should never be here
         list_t *node = list_get_head(&co_cv->cv_waiters);
         co_cv_waiter_t *co_cv_waiter = container_of(node, co_cv_waiter_t, node);
+        if (co_cv_waiter->co_waker) {
+            list_init(list_del(node));
+            continue;
+        }
         if (co_cv_waiter->co_cv_timeout) {
             co_cv_waiter->co_cv_timeout->valid = 0;
         }
+        *co_cv_waiter->woken = 1;
         list_del(node);
-        free(co_cv_waiter);
+        slab_free(&co_cv->co_scheduler->co_object_slab, co_cv_waiter);
     }
     list_destroy(&co_cv->cv_waiters);
     epoll_ctl(co_cv->co_scheduler->epollfd, EPOLL_CTL_DEL, co_cv->eventfd, 0);
     close(co_cv->eventfd);
 }
 
+// on the stack of a co_routine parked in co_cv_wait
+typedef struct __glove_co_cv_pending {
+    co_cv_t        *co_cv;
+    co_cv_waiter_t *co_cv_waiter;
+    int            *woken;
+    int            *timeout;
+} co_cv_pending_t;
+
+// the co_routine is destroyed while waiting, a waiter the signal or the
+// timer has not taken out yet is unlinked, its timer only frees itself
+static void co_cv_wait_cancel(co_routine_t *co_routine, void *co_wait) {
+    co_cv_pending_t *co_cv_pending = (co_cv_pending_t *)co_wait;
+    if (*co_cv_pending->woken || (co_cv_pending->timeout && *co_cv_pending->timeout))
+        return;
+
+    co_cv_waiter_t *co_cv_waiter = co_cv_pending->co_cv_waiter;
+    if (co_cv_waiter->co_cv_timeout)
+        co_cv_waiter->co_cv_timeout->valid = 0;
+    list_del(&co_cv_waiter->node);
+    slab_free(&co_cv_pending->co_cv->co_scheduler->co_object_slab, co_cv_waiter);
+}
+
+// after a wakeup that was neither a signal nor its own timer, such as
+// its deadline, the waiter is still linked, take it out again
+static int co_cv_unwait(co_cv_t *co_cv, co_cv_waiter_t *co_cv_waiter, int woken, int status) {
+    if (!woken) {
+        list_del(&co_cv_waiter->node);
+        slab_free(&co_cv->co_scheduler->co_object_slab, co_cv_waiter);
+        return status ? status : EINTR;
+    }
+
+    // signaled, but shed before it ran, hand the wakeup on
+    if (status == ETIMEDOUT)
+        co_cv_signal(co_cv, 1);
+    return status;
+}
+
 int co_cv_wait(co_cv_t *co_cv, co_routine_t *co_routine, int64_t wait_ms) {
     if (wait_ms > 0) {
         // wait with timeout
 
         int ret = 0;
-        int timeout = 1;
+        int timeout = 0;
+        int woken = 0;
 
-        co_cv_waiter_t *co_cv_waiter = (co_cv_waiter_t *)malloc(sizeof(co_cv_waiter_t));
-        co_cv_timeout_t *co_cv_timeout = (co_cv_timeout_t *)malloc(sizeof(co_cv_timeout_t));
+        slab_t *co_object_slab = &co_cv->co_scheduler->co_object_slab;
+        co_cv_waiter_t *co_cv_waiter = (co_cv_waiter_t *)slab_alloc(co_object_slab);
+        co_cv_timeout_t *co_cv_timeout = (co_cv_timeout_t *)slab_alloc(co_object_slab);
         if (!co_cv_waiter || !co_cv_timeout) {
             ret = ENOMEM;
             goto error_malloc;
@@ -131,7 +198,7 @@ int co_cv_wait(co_cv_t *co_cv, co_routine_t *co_routine, int64_t wait_ms) {
         }
 
         struct epoll_event read_event;
-        read_event.events = EPOLLIN;  // | EPOLLET;
+        read_event.events = EPOLLIN | co_cv->co_scheduler->co_epoll_flags;
         read_event.data.ptr = &co_cv_timeout->co_event_listener;
         ret = epoll_ctl(co_cv->co_scheduler->epollfd, EPOLL_CTL_ADD, co_cv_timeout->timerfd, &read_event);
         if (ret == -1) {
@@ -143,14 +210,25 @@ int co_cv_wait(co_cv_t *co_cv, co_routine_t *co_routine, int64_t wait_ms) {
         co_cv_timeout->co_event_listener.callback = co_cv_timerfd_callback;
 
         co_cv_timeout->node = &co_cv_waiter->node;
+        co_cv_timeout->co_scheduler = co_cv->co_scheduler;
 
         list_add_tail(&co_cv->cv_waiters, &co_cv_waiter->node);
         co_cv_waiter->co_routine = co_routine;
         co_cv_waiter->co_cv_timeout = co_cv_timeout;
+        co_cv_waiter->co_waker = 0;
+        co_cv_waiter->woken = &woken;
 
-        co_yield(co_routine);
+        co_cv_pending_t co_cv_pending = {co_cv, co_cv_waiter, &woken, &timeout};
+        co_routine->co_wait_cancel = co_cv_wait_cancel;
+        co_routine->co_wait = &co_cv_pending;
+        int status = co_yield(co_routine);
+        co_routine->co_wait_cancel = 0;
 
-        return timeout ? ETIMEDOUT : 0;
+        // the timer freed both already
+        if (timeout) return ETIMEDOUT;
+        // the timer frees itself once it fires
+        if (!woken) co_cv_timeout->valid = 0;
+        return co_cv_unwait(co_cv, co_cv_waiter, woken, status);
 
 
     error_epoll_ctl:
@@ -158,8 +236,8 @@ int co_cv_wait(co_cv_t *co_cv, co_routine_t *co_routine, int64_t wait_ms) {
         close(co_cv_timeout->timerfd);
     error_timerfd_create:
     error_malloc:
-        if (co_cv_waiter) free(co_cv_waiter);
-        if (co_cv_timeout) free(co_cv_timeout);
+        if (co_cv_waiter) slab_free(co_object_slab, co_cv_waiter);
+        if (co_cv_timeout) slab_free(co_object_slab, co_cv_timeout);
         return ret;
     } else if (wait_ms == 0) {
         // try wait
@@ -173,17 +251,40 @@ int co_cv_wait(co_cv_t *co_cv, co_routine_t *co_routine, int64_t wait_ms) {
         return 0;
     } else {
         // wait until signaled without timeout
-        co_cv_waiter_t *co_cv_waiter = (co_cv_waiter_t *)malloc(sizeof(co_cv_waiter_t));
+        co_cv_waiter_t *co_cv_waiter = (co_cv_waiter_t *)slab_alloc(&co_cv->co_scheduler->co_object_slab);
         if (!co_cv_waiter) return -ENOMEM;
 
+        int woken = 0;
         list_add_tail(&co_cv->cv_waiters, &co_cv_waiter->node);
         co_cv_waiter->co_routine = co_routine;
         co_cv_waiter->co_cv_timeout = 0;
+        co_cv_waiter->co_waker = 0;
+        co_cv_waiter->woken = &woken;
+
+        // ETIMEDOUT if the deadline of co_routine passed while waiting
+        co_cv_pending_t co_cv_pending = {co_cv, co_cv_waiter, &woken, 0};
+        co_routine->co_wait_cancel = co_cv_wait_cancel;
+        co_routine->co_wait = &co_cv_pending;
+        int status = co_yield(co_routine);
+        co_routine->co_wait_cancel = 0;
+        return co_cv_unwait(co_cv, co_cv_waiter, woken, status);
+    }
+}
 
-        co_yield(co_routine);
+int co_cv_wait_listener(co_cv_t *co_cv, co_cv_waiter_t *co_cv_waiter, co_event_listener_t *co_waker) {
+    // nothing is allocated, `co_cv_waiter` stays linked until `co_waker` is
+    // called or co_cv_cancel is called, and the node is reset to empty then
+    list_add_tail(&co_cv->cv_waiters, &co_cv_waiter->node);
+    co_cv_waiter->co_routine = 0;
+    co_cv_waiter->co_cv_timeout = 0;
+    co_cv_waiter->co_waker = co_waker;
+    co_cv_waiter->woken = 0;
+    return 0;
+}
 
-        return 0;
-    }
+void co_cv_cancel(co_cv_waiter_t *co_cv_waiter) {
+    if (!list_empty(&co_cv_waiter->node))
+        list_init(list_del(&co_cv_waiter->node));
 }
 
 void co_cv_signal(co_cv_t *co_cv, int64_t n) {
@@ -193,7 +294,7 @@ void co_cv_signal(co_cv_t *co_cv, int64_t n) {
 
 /** BEGIN: unit test **/
 #ifdef __MODULE_COCV__
-// gcc -g -Wall -fsanitize=address -D__MODULE_COCV__ cocv.c coroutine.c utils/list.c
+// gcc -g -Wall -fsanitize=address -D__MODULE_COCV__ cocv.c coroutine.c utils/slab.c
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -256,10 +357,33 @@ void fibonacci_run(int ptr_high_bits, int ptr_low_bits) {
     printf("[%s %d] return\n", __FUNCTION__, fibonacci->fibo_index);
 }
 
+static co_cv_t timed_cv;
+
+// its first timer is still armed when the second wait reuses the slab objects
+void timed_run(int ptr_high_bits, int ptr_low_bits) {
+    co_routine_t *timed_routine = co_this(ptr_high_bits, ptr_low_bits);
+
+    int ret = co_cv_wait(&timed_cv, timed_routine, 100);
+    printf("[%s] first timed wait, ret: %d\n", __FUNCTION__, ret);
+    ret = co_cv_wait(&timed_cv, timed_routine, 100);
+    printf("[%s] second timed wait, ret: %d\n", __FUNCTION__, ret);
+}
+
+// one of two waiters expires before the signal, the other one gets it
+void expiring_run(int ptr_high_bits, int ptr_low_bits) {
+    co_routine_t *expiring_routine = co_this(ptr_high_bits, ptr_low_bits);
+
+    int ret = co_cv_wait(&timed_cv, expiring_routine, -1);
+    printf("[%s] wait, ret: %d, deadline set: %d\n", __FUNCTION__, ret, expiring_routine->co_deadline_us != 0);
+}
+
 void init(int ptr_high_bits, int ptr_low_bits) {
     co_routine_t *co_uinit = co_this(ptr_high_bits, ptr_low_bits);
     printf("[%s] enter\n", __FUNCTION__);
 
+    // everything below is registered edge-triggered
+    co_scheduler_set_edge_triggered(co_uinit->co_scheduler, 1);
+
     fibonacci_t *fibonaccis = (fibonacci_t *)malloc(sizeof(fibonacci_t) * FIBO_N);
     for (int i = FIBO_N - 1; i >= 0; i--) {
         co_init(&fibonaccis[i].fibo_routine, co_uinit->co_scheduler, fibonacci_run);
@@ -284,6 +408,41 @@ void init(int ptr_high_bits, int ptr_low_bits) {
     }
     printf("\n");
 
+    co_cv_init(&timed_cv, co_uinit->co_scheduler);
+    co_routine_t *timed_routines[2];
+    for (int i = 0; i < 2; i++)
+        timed_routines[i] = co_create(co_uinit->co_scheduler, timed_run);
+    co_resume(co_uinit);
+    co_yield(co_uinit);
+    co_cv_signal(&timed_cv, 2);
+    co_cv_wait(&fibonaccis[0].fibo_cv, co_uinit, 300);
+    for (int i = 0; i < 2; i++)
+        co_release(timed_routines[i]);
+
+    for (int i = 0; i < 2; i++)
+        timed_routines[i] = co_create(co_uinit->co_scheduler, expiring_run);
+    co_resume(co_uinit);
+    co_yield(co_uinit);
+    co_set_deadline(timed_routines[0], co_clock_us() - 1);
+    co_cv_signal(&timed_cv, 1);
+    co_cv_wait(&fibonaccis[0].fibo_cv, co_uinit, 100);
+    printf("[%s] waiters left: %d\n", __FUNCTION__, !list_empty(&timed_cv.cv_waiters));
+    for (int i = 0; i < 2; i++)
+        co_release(timed_routines[i]);
+
+    // released while parked, their waiters leave the cv with them,
+    // the orphaned timer only frees itself once it fires
+    timed_routines[0] = co_create(co_uinit->co_scheduler, expiring_run);
+    timed_routines[1] = co_create(co_uinit->co_scheduler, timed_run);
+    co_resume(co_uinit);
+    co_yield(co_uinit);
+    for (int i = 0; i < 2; i++)
+        co_release(timed_routines[i]);
+    printf("[%s] waiters left after release: %d\n", __FUNCTION__, !list_empty(&timed_cv.cv_waiters));
+    co_cv_signal(&timed_cv, 2);
+    co_cv_wait(&fibonaccis[0].fibo_cv, co_uinit, 150);
+    co_cv_destroy(&timed_cv);
+
     for (int i = 0; i < FIBO_N; i++) {
         co_cv_destroy(&fibonaccis[i].fibo_cv);
         co_destroy(&fibonaccis[i].fibo_routine);
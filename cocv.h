@@ -6,6 +6,11 @@
 #include "utils/list.h"
 
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
 typedef struct __glove_co_cv_timeout {
     int                  timerfd;
     // Timeout callback only acts when `valid` is not a nullptr,
@@ -15,13 +20,21 @@ typedef struct __glove_co_cv_timeout {
     // by setting the variable pointed by to `True`.
     int                 *valid;
     co_event_listener_t  co_event_listener;
+    // the waiter behind `node` may already be freed once `valid` is cleared
     list_t              *node;
+    co_scheduler_t      *co_scheduler;
 } co_cv_timeout_t;
 
 typedef struct __glove_co_cv_waiter {
-    list_t           node;
-    co_routine_t    *co_routine;
-    co_cv_timeout_t *co_cv_timeout;
+    list_t               node;
+    co_routine_t        *co_routine;
+    co_cv_timeout_t     *co_cv_timeout;
+    // set for waiters owned by the caller of co_cv_wait_listener,
+    // called from kloopd instead of resuming `co_routine`
+    co_event_listener_t *co_waker;
+    // set to 1 by the signal that unlinks the waiter, left 0 when
+    // `co_routine` is woken by anything else and must unlink itself
+    int                 *woken;
 } co_cv_waiter_t;
 
 typedef struct __glove_co_cv {
@@ -35,7 +48,14 @@ typedef struct __glove_co_cv {
 co_cv_t *co_cv_init(co_cv_t *co_cv, co_scheduler_t *co_scheduler);
 void co_cv_destroy(co_cv_t *co_cv);
 int co_cv_wait(co_cv_t *co_cv, co_routine_t *co_routine, int64_t wait_ms);
+int co_cv_wait_listener(co_cv_t *co_cv, co_cv_waiter_t *co_cv_waiter, co_event_listener_t *co_waker);
+void co_cv_cancel(co_cv_waiter_t *co_cv_waiter);
 void co_cv_signal(co_cv_t *co_cv, int64_t n);
 
 
+#ifdef __cplusplus
+}
+#endif
+
+
 #endif
\ No newline at end of file
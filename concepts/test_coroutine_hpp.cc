@@ -0,0 +1,82 @@
+#include <iostream>
+#include <string>
+
+#include <unistd.h>
+
+#include "../coroutine.hpp"
+
+
+static int pending = 0;
+
+// the copy that goes into the co_stack throws
+struct throws_on_copy {
+    bool armed = false;
+    throws_on_copy() = default;
+    throws_on_copy(const throws_on_copy &other) : armed(true) {
+        if (other.armed) throw std::bad_alloc();
+    }
+};
+
+
+glove::task wait_cv(glove::cv &ready, glove::cv &done) {
+    std::cout << "[task] waiting on cv" << std::endl;
+    co_await ready;
+    std::cout << "[task] cv signaled" << std::endl;
+    pending--;
+    done.signal();
+}
+
+glove::task wait_pipe(co_scheduler_t *co_scheduler, int fd, glove::cv &done) {
+    std::cout << "[task] waiting on pipe" << std::endl;
+    uint32_t events = co_await glove::readable(co_scheduler, fd);
+    char c;
+    ssize_t n = read(fd, &c, 1);
+    std::cout << "[task] pipe events " << events << ", read " << n << " byte '" << c << "'" << std::endl;
+    pending--;
+    done.signal();
+}
+
+
+// gcc -c ../coroutine.c ../cocv.c ../utils/slab.c && g++ -std=c++20 -Wall test_coroutine_hpp.cc coroutine.o cocv.o slab.o
+int main(int argc, char *argv[]) {
+    glove::scheduler scheduler([&scheduler] {
+        co_scheduler_t *co_scheduler = scheduler.get();
+
+        glove::cv ready(co_scheduler), done(co_scheduler);
+
+        // captures live at the top of the routine's co_stack
+        std::string greeting = "hello from a routine";
+        glove::routine routine(co_scheduler, [greeting, &done] {
+            std::cout << "[routine] " << greeting << std::endl;
+            done.signal();
+        });
+        done.wait();
+        std::cout << "[uinit] routine done: " << routine.done() << std::endl;
+
+        throws_on_copy capture;
+        auto never = [capture] { std::cout << "[routine] never runs" << std::endl; };
+        try {
+            glove::routine failed(co_scheduler, never);
+        } catch (const std::bad_alloc &) {
+            std::cout << "[uinit] routine not spawned, capture threw" << std::endl;
+        }
+
+        int fds[2];
+        if (pipe(fds) == -1) return;
+        pending = 2;
+        wait_cv(ready, done);
+        wait_pipe(co_scheduler, fds[0], done);
+
+        ready.signal();
+        write(fds[1], "x", 1);
+        // signals are not counted, both tasks may be woken by one dispatch
+        while (pending > 0) done.wait();
+
+        close(fds[0]);
+        close(fds[1]);
+        scheduler.exit();
+        std::cout << "[uinit] return" << std::endl;
+    });
+    scheduler.run();
+    return 0;
+}
@@ -1,47 +1,416 @@
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include "coroutine.h"
 
 
+_Static_assert(sizeof(co_fd_t) <= CO_OBJECT_SIZE, "co_fd_t outgrew CO_OBJECT_SIZE");
+
+
+__thread co_routine_t *co_current_routine = 0;
+
+// a key is taken once its slot holds a destructor, keys created
+// without one hold co_local_keep, which leaves the value alone
+static void (*co_local_destructors[CO_LOCAL_SLOTS])(void *);
+
+static void co_local_keep(void *value) {}
+
+
+static int co_edf_less(pheap_node_t *a, pheap_node_t *b) {
+    co_routine_t *co_a = container_of(a, co_routine_t, co_edf_node);
+    co_routine_t *co_b = container_of(b, co_routine_t, co_edf_node);
+    return co_a->co_deadline_us < co_b->co_deadline_us;
+}
+
+static int co_deadline_less(pheap_node_t *a, pheap_node_t *b) {
+    co_routine_t *co_a = container_of(a, co_routine_t, co_deadline_node);
+    co_routine_t *co_b = container_of(b, co_routine_t, co_deadline_node);
+    return co_a->co_deadline_us < co_b->co_deadline_us;
+}
+
+static void co_deadline_disarm(co_routine_t *co_routine) {
+    if (co_routine->co_deadline_armed) {
+        pheap_remove(&co_routine->co_scheduler->co_deadlines, &co_routine->co_deadline_node);
+        co_routine->co_deadline_armed = 0;
+    }
+}
+
+static int co_scheduler_queued(co_routine_t *co_routine) {
+    return co_routine->co_edf_queued || !list_empty(&co_routine->co_ready_node);
+}
+
+static void co_scheduler_enqueue(co_scheduler_t *co_scheduler, co_routine_t *co_routine) {
+    if (!co_scheduler->co_edf || !co_routine->co_deadline_us) {
+        list_add_tail(&co_scheduler->co_ready[co_routine->co_priority], &co_routine->co_ready_node);
+        return;
+    }
+
+    pheap_insert(&co_scheduler->co_edf_ready[co_routine->co_priority], &co_routine->co_edf_node);
+    co_routine->co_edf_queued = 1;
+}
+
+static void co_scheduler_dequeue(co_routine_t *co_routine) {
+    if (co_routine->co_edf_queued) {
+        pheap_remove(&co_routine->co_scheduler->co_edf_ready[co_routine->co_priority], &co_routine->co_edf_node);
+        co_routine->co_edf_queued = 0;
+    } else {
+        list_init(list_del(&co_routine->co_ready_node));
+    }
+}
+
+static void co_scheduler_requeue(co_routine_t *co_routine) {
+    if (co_scheduler_queued(co_routine)) {
+        co_scheduler_dequeue(co_routine);
+        co_scheduler_enqueue(co_routine->co_scheduler, co_routine);
+    }
+}
+
+// the edf heap is picked by co_priority, so leave it before the level changes
+static void co_scheduler_reprioritize(co_routine_t *co_routine, int priority) {
+    int queued = co_scheduler_queued(co_routine);
+    if (queued) co_scheduler_dequeue(co_routine);
+    co_routine->co_priority = priority;
+    if (queued) co_scheduler_enqueue(co_routine->co_scheduler, co_routine);
+}
+
 static void co_routine_eventfd_callback(co_event_listener_t *co_event_listener) {
     co_routine_t *co_routine = container_of(co_event_listener, co_routine_t, co_event_listener);
 
+    // only queue it here, the event is cleared when the co_routine is dispatched,
+    // so resumes issued before that are merged into a single run
+    if (!co_scheduler_queued(co_routine))
+        co_scheduler_enqueue(co_routine->co_scheduler, co_routine);
+}
+
+typedef struct __glove_co_fd_waiter {
+    co_event_listener_t  co_event_listener;
+    co_routine_t        *co_routine;
+    int                  fd;
+    uint32_t             revents;
+} co_fd_waiter_t;
+
+// the co_routine is destroyed while waiting, the waiter goes with its stack
+static void co_fd_waiter_cancel(co_routine_t *co_routine, void *co_wait) {
+    co_fd_waiter_t *co_fd_waiter = (co_fd_waiter_t *)co_wait;
+    co_fd_unwatch(co_routine->co_scheduler, co_fd_waiter->fd, &co_fd_waiter->co_event_listener);
+}
+
+static void co_fd_waiter_callback(co_event_listener_t *co_event_listener) {
+    co_fd_waiter_t *co_fd_waiter = container_of(co_event_listener, co_fd_waiter_t, co_event_listener);
+
+    co_fd_waiter->revents = co_event_listener->events;
+    co_resume(co_fd_waiter->co_routine);
+}
+
+// register what the watchers still wait for, or drop the fd once none is left
+static int co_fd_update(co_fd_t *co_fd) {
+    co_scheduler_t *co_scheduler = co_fd->co_scheduler;
+
+    if (!co_fd->reader && !co_fd->writer && !co_fd->error) {
+        if (co_fd->registered)
+            epoll_ctl(co_scheduler->epollfd, EPOLL_CTL_DEL, co_fd->fd, 0);
+        co_scheduler->co_fds[co_fd->fd] = 0;
+        slab_free(&co_scheduler->co_object_slab, co_fd);
+        return 0;
+    }
+
+    // always re-armed, so an edge consumed by one watcher is seen again by the next
+    struct epoll_event wait_event;
+    wait_event.events = co_scheduler->co_epoll_flags;
+    if (co_fd->reader) wait_event.events |= co_fd->reader_events;
+    if (co_fd->writer) wait_event.events |= co_fd->writer_events;
+    // EPOLLERR and EPOLLHUP are always reported, a hung up fd left
+    // to the error watcher alone would be reported over and over
+    if (!co_fd->reader && !co_fd->writer) wait_event.events |= EPOLLET;
+    wait_event.data.ptr = &co_fd->co_event_listener;
+    int op = co_fd->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(co_scheduler->epollfd, op, co_fd->fd, &wait_event) == -1)
+        return errno;
+
+    co_fd->registered = 1;
+    return 0;
+}
+
+static void co_fd_callback(co_event_listener_t *co_event_listener) {
+    co_fd_t *co_fd = container_of(co_event_listener, co_fd_t, co_event_listener);
+    uint32_t revents = co_event_listener->events;
+
+    // the error watcher drains the error queue, EPOLLERR is only passed on
+    // when it is still raised after that, by a pending socket error,
+    // so queued notifications such as MSG_ZEROCOPY completions never wake
+    // a parked reader, which would find nothing to read and wait again
+    if ((revents & EPOLLERR) && co_fd->error) {
+        co_fd->error->events = revents;
+        co_fd->error->callback(co_fd->error);
+
+        struct pollfd pollfd = {.fd = co_fd->fd, .events = 0, .revents = 0};
+        if (poll(&pollfd, 1, 0) != -1 && !(pollfd.revents & POLLERR))
+            revents &= ~EPOLLERR;
+    }
+
+    co_event_listener_t *reader = 0, *writer = 0;
+    if (co_fd->reader && (revents & (co_fd->reader_events | EPOLLERR | EPOLLHUP))) {
+        reader = co_fd->reader;
+        co_fd->reader = 0;
+    }
+    if (co_fd->writer && (revents & (co_fd->writer_events | EPOLLERR | EPOLLHUP))) {
+        writer = co_fd->writer;
+        co_fd->writer = 0;
+    }
+    // may free co_fd, the watchers only queue their wakeup
+    co_fd_update(co_fd);
+
+    if (reader) {
+        reader->events = revents;
+        reader->callback(reader);
+    }
+    if (writer) {
+        writer->events = revents;
+        writer->callback(writer);
+    }
+}
+
+static co_routine_t *co_scheduler_pick(co_scheduler_t *co_scheduler) {
+    for (int i = 0; i < CO_PRIORITY_LEVELS; i++) {
+        // within a level, co_routines with a deadline go first, earliest first,
+        // a higher level is never held up by deadlines of a lower one
+        if (!pheap_empty(&co_scheduler->co_edf_ready[i])) {
+            pheap_node_t *node = pheap_pop(&co_scheduler->co_edf_ready[i]);
+            co_routine_t *co_routine = container_of(node, co_routine_t, co_edf_node);
+            co_routine->co_edf_queued = 0;
+            return co_routine;
+        }
+        if (!list_empty(&co_scheduler->co_ready[i])) {
+            list_t *node = list_del(list_get_head(&co_scheduler->co_ready[i]));
+            list_init(node);
+            return container_of(node, co_routine_t, co_ready_node);
+        }
+    }
+    return 0;
+}
+
+static void co_scheduler_dispatch(co_scheduler_t *co_scheduler, co_routine_t *co_routine) {
     // clear event
     uint64_t count;
     read(co_routine->eventfd, &count, sizeof(count));
 
-    swapcontext(&co_routine->co_scheduler->co_kloopd.co_context, &co_routine->co_context);
+    // there is no context left to switch to
+    if (co_routine->co_finished) return;
+
+    // an expired co_routine that has not started yet is dropped, fn never runs,
+    // a started one is still switched in, but only to unwind:
+    // the co_yield it is parked in returns ETIMEDOUT instead of 0, once,
+    // the deadline is dropped so whatever it blocks on next runs normally
+    co_routine->co_status = 0;
+    if (co_routine->co_deadline_us && co_clock_us() >= co_routine->co_deadline_us) {
+        co_routine->co_status = ETIMEDOUT;
+        co_routine->co_deadline_us = 0;
+        co_deadline_disarm(co_routine);
+        co_scheduler->co_shed++;
+        if (!co_routine->co_started) {
+            co_routine->co_finished = 1;
+            return;
+        }
+    }
+
+    int64_t start_us = co_routine->co_budget_us ? co_clock_us() : 0;
+    co_routine->co_started = 1;
+    co_routine->co_suspended = 0;
+    co_current_routine = co_routine;
+    swapcontext(&co_scheduler->co_kloopd.co_context, &co_routine->co_context);
+    co_current_routine = &co_scheduler->co_kloopd;
+
+    // back here without co_suspend, fn has returned
+    if (!co_routine->co_suspended) {
+        co_routine->co_finished = 1;
+        co_routine->co_deadline_us = 0;
+        co_deadline_disarm(co_routine);
+    }
+
+    if (!co_routine->co_budget_us) return;
+    int64_t elapsed_us = co_clock_us() - start_us;
+
+    if (elapsed_us > co_routine->co_budget_us) {
+        co_routine->co_overruns++;
+        co_routine->co_budget_kept = 0;
+        if (co_scheduler->co_overrun_hook)
+            co_scheduler->co_overrun_hook(co_routine, elapsed_us);
+        if (co_routine->co_budget_demote && co_routine->co_priority < CO_PRIORITY_LEVELS - 1)
+            co_scheduler_reprioritize(co_routine, co_routine->co_priority + 1);
+    } else if (co_routine->co_priority > co_routine->co_base_priority &&
+               ++co_routine->co_budget_kept >= CO_BUDGET_RESTORE) {
+        // a single overrun, a page fault or a slow syscall, is not held against it forever
+        co_routine->co_budget_kept = 0;
+        co_scheduler_reprioritize(co_routine, co_routine->co_priority - 1);
+    }
+}
+
+
+static void co_scheduler_wakefd_callback(co_event_listener_t *co_event_listener) {
+    co_scheduler_t *co_scheduler = container_of(co_event_listener, co_scheduler_t, co_wake_listener);
+
+    uint64_t count;
+    read(co_scheduler->wakefd, &count, sizeof(count));
+}
+
+static void co_scheduler_deadline_callback(co_event_listener_t *co_event_listener) {
+    co_scheduler_t *co_scheduler = container_of(co_event_listener, co_scheduler_t, co_deadline_listener);
+
+    uint64_t count;
+    read(co_scheduler->deadline_timerfd, &count, sizeof(count));
+    co_scheduler->co_deadline_timer_us = 0;
+}
+
+// queue every co_routine whose deadline passed, whatever it is parked on,
+// dispatch sheds it then
+static void co_scheduler_expire(co_scheduler_t *co_scheduler) {
+    int64_t now_us = co_clock_us();
+    while (!pheap_empty(&co_scheduler->co_deadlines)) {
+        co_routine_t *co_routine = container_of(pheap_top(&co_scheduler->co_deadlines), co_routine_t, co_deadline_node);
+        if (co_routine->co_deadline_us > now_us) break;
+
+        pheap_pop(&co_scheduler->co_deadlines);
+        co_routine->co_deadline_armed = 0;
+        if (!co_scheduler_queued(co_routine))
+            co_scheduler_enqueue(co_scheduler, co_routine);
+    }
+}
+
+// keep deadline_timerfd armed for the earliest deadline still pending
+static void co_scheduler_arm_deadline(co_scheduler_t *co_scheduler) {
+    int64_t deadline_us = 0;
+    if (!pheap_empty(&co_scheduler->co_deadlines))
+        deadline_us = container_of(pheap_top(&co_scheduler->co_deadlines), co_routine_t, co_deadline_node)->co_deadline_us;
+    if (deadline_us == co_scheduler->co_deadline_timer_us) return;
+
+    // all zero disarms, a deadline already passed fires at once
+    struct itimerspec spec = {
+        .it_interval = {0, 0},
+        .it_value = {
+            .tv_sec = deadline_us / 1000000,
+            .tv_nsec = deadline_us % 1000000 * 1000
+        }
+    };
+    timerfd_settime(co_scheduler->deadline_timerfd, TFD_TIMER_ABSTIME, &spec, 0);
+    co_scheduler->co_deadline_timer_us = deadline_us;
+}
+
+static int co_scheduler_poll(co_scheduler_t *co_scheduler, struct epoll_event *epoll_events, int batch) {
+    // held back by the last pass, already runnable
+    for (int i = 0; i < CO_PRIORITY_LEVELS; i++)
+        if (!list_empty(&co_scheduler->co_ready[i]) || !pheap_empty(&co_scheduler->co_edf_ready[i]))
+            return epoll_wait(co_scheduler->epollfd, epoll_events, batch, 0);
+
+    if (co_scheduler->co_busy_poll_us) {
+        int64_t until_us = co_clock_us() + co_scheduler->co_busy_poll_us;
+        do {
+            int num_events = epoll_wait(co_scheduler->epollfd, epoll_events, batch, 0);
+            if (num_events) return num_events;
+        } while (co_clock_us() < until_us);
+    }
+
+    // co_scheduler_exit writes wakefd, no need for a timeout
+    return epoll_wait(co_scheduler->epollfd, epoll_events, batch, -1);
 }
 
 
+// run the callbacks of one epoll batch, then whatever they deferred,
+// and queue the co_routines whose deadline passed meanwhile
+static void co_scheduler_process(co_scheduler_t *co_scheduler, struct epoll_event *epoll_events, int num_events) {
+    for (int i = 0; i < num_events; i++) {
+        co_event_listener_t *co_event_listener = (co_event_listener_t *)epoll_events[i].data.ptr;
+        co_event_listener->events = epoll_events[i].events;
+        co_event_listener->callback(co_event_listener);
+    }
+
+    // the batch is done, nothing in epoll_events is touched any more
+    while (!list_empty(&co_scheduler->co_deferred)) {
+        list_t *node = list_init(list_del(list_get_head(&co_scheduler->co_deferred)));
+        co_deferred_t *co_deferred = container_of(node, co_deferred_t, node);
+        co_deferred->callback(co_deferred);
+    }
+
+    co_scheduler_expire(co_scheduler);
+}
+
 static void kloopd(int ptr_high_bits, int ptr_low_bits) {
     co_routine_t *co_kloopd = co_this(ptr_high_bits, ptr_low_bits);
     co_scheduler_t *co_scheduler = co_kloopd->co_scheduler;
 
-    const size_t EPOLL_EVENT_SIZE = 1024;
-    struct epoll_event epoll_events[EPOLL_EVENT_SIZE];
-    while (co_scheduler->co_running) {
-        int num_events = epoll_wait(co_scheduler->epollfd, epoll_events, EPOLL_EVENT_SIZE, 1000 /* milliseconds */);
+    struct epoll_event epoll_events[CO_EPOLL_BATCH_MAX];
+    int batch = CO_EPOLL_BATCH_MIN;
+    int64_t pass = 0;
+    while (__atomic_load_n(&co_scheduler->co_running, __ATOMIC_ACQUIRE)) {
+        co_scheduler_arm_deadline(co_scheduler);
+        int num_events = co_scheduler_poll(co_scheduler, epoll_events, batch);
+
+        // a full batch means more is pending, a sparse one wastes a large buffer
+        if (num_events == batch && batch < CO_EPOLL_BATCH_MAX)
+            batch *= 2;
+        else if (num_events < batch / 4 && batch > CO_EPOLL_BATCH_MIN)
+            batch /= 2;
+
+        co_scheduler_process(co_scheduler, epoll_events, num_events);
 
-        for (int i = 0; i < num_events; i++) {
-            co_event_listener_t *co_event_listener = (co_event_listener_t *)epoll_events[i].data.ptr;
-            co_event_listener->callback(co_event_listener);
+        // run every ready co_routine, higher priority first
+        pass++;
+        list_t held;
+        list_init(&held);
+        co_routine_t *co_routine;
+        int priority = CO_PRIORITY_HIGH;
+        while ((co_routine = co_scheduler_pick(co_scheduler))) {
+            // woken again by the poll below, it waits for the next pass
+            // unless it outranks what just ran, a spinning co_routine
+            // would starve the lower levels otherwise
+            if (co_routine->co_pass == pass && co_routine->co_priority >= priority) {
+                list_add_tail(&held, &co_routine->co_ready_node);
+                continue;
+            }
+
+            co_routine->co_pass = pass;
+            priority = co_routine->co_priority;
+            co_scheduler_dispatch(co_scheduler, co_routine);
+
+            // a slice below the top level may have let higher work become ready,
+            // look without blocking so it does not wait for the rest of the drain
+            if (priority > CO_PRIORITY_HIGH) {
+                co_scheduler_arm_deadline(co_scheduler);
+                num_events = epoll_wait(co_scheduler->epollfd, epoll_events, batch, 0);
+                co_scheduler_process(co_scheduler, epoll_events, num_events);
+            }
+        }
+
+        while (!list_empty(&held)) {
+            list_t *node = list_init(list_del(list_get_head(&held)));
+            co_scheduler_enqueue(co_scheduler, container_of(node, co_routine_t, co_ready_node));
         }
     }
 }
 
 
 co_routine_t *co_init(co_routine_t *co_routine, co_scheduler_t *co_scheduler, void (*fn)(int, int)) {
+    return co_init_reserve(co_routine, co_scheduler, fn, 0);
+}
+
+co_routine_t *co_init_reserve(co_routine_t *co_routine, co_scheduler_t *co_scheduler, void (*fn)(int, int), size_t reserve) {
+    if (reserve >= CO_STACK_SIZE - 16) goto error_co_id;
+    unsigned char *reserved = (unsigned char *)co_stack_reserved(co_routine, reserve);
+
     co_routine->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
     if (co_routine->eventfd == -1) goto error_co_id;
 
     getcontext(&co_routine->co_context);
     co_routine->co_context.uc_link = &co_scheduler->co_kloopd.co_context;
     co_routine->co_context.uc_stack.ss_sp = co_routine->co_stack;
-    co_routine->co_context.uc_stack.ss_size = CO_STACK_SIZE;
+    co_routine->co_context.uc_stack.ss_size = reserved - co_routine->co_stack;
     int ptr_high_bits = (uintptr_t)co_routine >> 32;
     int ptr_low_bits = (uintptr_t)co_routine << 32 >> 32;
     makecontext(&co_routine->co_context, (void (*)(void))fn, 2, ptr_high_bits, ptr_low_bits);
@@ -50,8 +419,27 @@ co_routine_t *co_init(co_routine_t *co_routine, co_scheduler_t *co_scheduler, vo
 
     co_routine->co_scheduler = co_scheduler;
 
+    list_init(&co_routine->co_ready_node);
+    co_routine->co_edf_queued = 0;
+    co_routine->co_pass = 0;
+    co_routine->co_priority = CO_PRIORITY_NORMAL;
+    co_routine->co_base_priority = CO_PRIORITY_NORMAL;
+    co_routine->co_budget_us = 0;
+    co_routine->co_budget_demote = 0;
+    co_routine->co_budget_kept = 0;
+    co_routine->co_overruns = 0;
+    co_routine->co_deadline_us = 0;
+    co_routine->co_deadline_armed = 0;
+    co_routine->co_suspended = 0;
+    co_routine->co_wait_cancel = 0;
+    co_routine->co_wait = 0;
+    co_routine->co_started = 0;
+    co_routine->co_finished = 0;
+    co_routine->co_status = 0;
+    memset(co_routine->co_locals, 0, sizeof(co_routine->co_locals));
+
     struct epoll_event read_event;
-    read_event.events = EPOLLIN;  // | EPOLLET;
+    read_event.events = EPOLLIN | co_scheduler->co_epoll_flags;
     read_event.data.ptr = &co_routine->co_event_listener;
     int ret = epoll_ctl(co_routine->co_scheduler->epollfd, EPOLL_CTL_ADD, co_routine->eventfd, &read_event);
     if (ret == -1) goto error_event_callback;
@@ -70,27 +458,256 @@ error_co_id:
 }
 
 void co_destroy(co_routine_t *co_routine) {
+    if (co_routine->co_wait_cancel)
+        co_routine->co_wait_cancel(co_routine, co_routine->co_wait);
+    if (co_scheduler_queued(co_routine))
+        co_scheduler_dequeue(co_routine);
+    co_deadline_disarm(co_routine);
+
+    for (int key = 0; key < CO_LOCAL_SLOTS; key++) {
+        void (*destructor)(void *) = __atomic_load_n(&co_local_destructors[key], __ATOMIC_ACQUIRE);
+        if (co_routine->co_locals[key] && destructor)
+            destructor(co_routine->co_locals[key]);
+    }
+
     epoll_ctl(co_routine->co_scheduler->epollfd, EPOLL_CTL_DEL, co_routine->eventfd, 0);
     close(co_routine->eventfd);
 }
 
+co_routine_t *co_create(co_scheduler_t *co_scheduler, void (*fn)(int, int)) {
+    return co_create_reserve(co_scheduler, fn, 0);
+}
+
+// must be called on the thread running co_scheduler
+co_routine_t *co_create_reserve(co_scheduler_t *co_scheduler, void (*fn)(int, int), size_t reserve) {
+    co_routine_t *co_routine = (co_routine_t *)slab_alloc(&co_scheduler->co_routine_slab);
+    if (!co_routine) return 0;
+
+    if (!co_init_reserve(co_routine, co_scheduler, fn, reserve)) {
+        slab_free(&co_scheduler->co_routine_slab, co_routine);
+        return 0;
+    }
+    return co_routine;
+}
+
+void co_release(co_routine_t *co_routine) {
+    co_destroy(co_routine);
+    slab_free(&co_routine->co_scheduler->co_routine_slab, co_routine);
+}
+
 void co_resume(co_routine_t *swap_in) {
     uint64_t count = 1;
     write(swap_in->eventfd, &count, sizeof(count));
 }
 
-void co_yield(co_routine_t *swap_out) {
+int co_suspend(co_routine_t *swap_out) {
+    swap_out->co_suspended = 1;
     swapcontext(&swap_out->co_context, &swap_out->co_scheduler->co_kloopd.co_context);
+    return swap_out->co_status;
+}
+
+void co_set_priority(co_routine_t *co_routine, int priority) {
+    if (priority < 0) priority = 0;
+    if (priority >= CO_PRIORITY_LEVELS) priority = CO_PRIORITY_LEVELS - 1;
+
+    co_routine->co_base_priority = priority;
+    co_routine->co_budget_kept = 0;
+    co_scheduler_reprioritize(co_routine, priority);
+}
+
+void co_set_budget(co_routine_t *co_routine, int64_t budget_us, int demote) {
+    co_routine->co_budget_us = budget_us > 0 ? budget_us : 0;
+    co_routine->co_budget_demote = demote;
+}
+
+// once it passes, the co_routine is dispatched and shed even while parked
+void co_set_deadline(co_routine_t *co_routine, int64_t deadline_us) {
+    co_deadline_disarm(co_routine);
+    co_routine->co_deadline_us = deadline_us > 0 ? deadline_us : 0;
+    if (co_routine->co_deadline_us) {
+        pheap_insert(&co_routine->co_scheduler->co_deadlines, &co_routine->co_deadline_node);
+        co_routine->co_deadline_armed = 1;
+    }
+    co_scheduler_requeue(co_routine);
+}
+
+int co_wait_fd(co_routine_t *co_routine, int fd, uint32_t events, uint32_t *revents) {
+    // the waiter lives on the stack of the parked co_routine
+    co_fd_waiter_t co_fd_waiter;
+    co_fd_waiter.co_event_listener.callback = co_fd_waiter_callback;
+    co_fd_waiter.co_routine = co_routine;
+    co_fd_waiter.fd = fd;
+    co_fd_waiter.revents = 0;
+
+    int ret = co_fd_watch(co_routine->co_scheduler, fd, events, &co_fd_waiter.co_event_listener);
+    if (ret) return ret;
+
+    // revents stays 0 when co_routine is resumed by someone else
+    co_routine->co_wait_cancel = co_fd_waiter_cancel;
+    co_routine->co_wait = &co_fd_waiter;
+    int status = co_yield(co_routine);
+    co_routine->co_wait_cancel = 0;
+
+    co_fd_unwatch(co_routine->co_scheduler, fd, &co_fd_waiter.co_event_listener);
+    if (revents) *revents = co_fd_waiter.revents;
+    return status;
+}
+
+// the registration of fd, created on first use
+static int co_fd_get(co_scheduler_t *co_scheduler, int fd, co_fd_t **co_fd_out) {
+    if (fd < 0) return EBADF;
+
+    if (fd >= co_scheduler->co_fds_size) {
+        int size = co_scheduler->co_fds_size ? co_scheduler->co_fds_size : 64;
+        while (size <= fd) size *= 2;
+        co_fd_t **co_fds = (co_fd_t **)realloc(co_scheduler->co_fds, size * sizeof(co_fd_t *));
+        if (!co_fds) return ENOMEM;
+        memset(co_fds + co_scheduler->co_fds_size, 0, (size - co_scheduler->co_fds_size) * sizeof(co_fd_t *));
+        co_scheduler->co_fds = co_fds;
+        co_scheduler->co_fds_size = size;
+    }
+
+    co_fd_t *co_fd = co_scheduler->co_fds[fd];
+    if (!co_fd) {
+        co_fd = (co_fd_t *)slab_alloc(&co_scheduler->co_object_slab);
+        if (!co_fd) return ENOMEM;
+        co_fd->co_event_listener.callback = co_fd_callback;
+        co_fd->fd = fd;
+        co_fd->registered = 0;
+        co_fd->reader = 0;
+        co_fd->writer = 0;
+        co_fd->error = 0;
+        co_fd->co_scheduler = co_scheduler;
+        co_scheduler->co_fds[fd] = co_fd;
+    }
+
+    *co_fd_out = co_fd;
+    return 0;
+}
+
+// `co_event_listener` is called once from kloopd with the epoll events;
+// a watcher asking for EPOLLIN takes the reading slot of fd, any other the
+// writing one, so a reader and a writer of one socket can wait at once,
+// EBUSY when the slot is taken
+int co_fd_watch(co_scheduler_t *co_scheduler, int fd, uint32_t events, co_event_listener_t *co_event_listener) {
+    co_fd_t *co_fd;
+    int ret = co_fd_get(co_scheduler, fd, &co_fd);
+    if (ret) return ret;
+
+    co_event_listener_t **slot = events & EPOLLIN ? &co_fd->reader : &co_fd->writer;
+    if (*slot) return EBUSY;
+    *slot = co_event_listener;
+    if (events & EPOLLIN) co_fd->reader_events = events;
+    else co_fd->writer_events = events;
+
+    ret = co_fd_update(co_fd);
+    if (ret) {
+        *slot = 0;
+        co_fd_update(co_fd);
+    }
+    return ret;
+}
+
+// `co_event_listener` is called from kloopd on every EPOLLERR of fd, before
+// the other watchers, until co_fd_unwatch; it must empty the error queue,
+// MSG_ERRQUEUE, and must not unwatch from the callback, EBUSY when taken
+int co_fd_watch_error(co_scheduler_t *co_scheduler, int fd, co_event_listener_t *co_event_listener) {
+    co_fd_t *co_fd;
+    int ret = co_fd_get(co_scheduler, fd, &co_fd);
+    if (ret) return ret;
+
+    if (co_fd->error) return EBUSY;
+    co_fd->error = co_event_listener;
+
+    ret = co_fd_update(co_fd);
+    if (ret) {
+        co_fd->error = 0;
+        co_fd_update(co_fd);
+    }
+    return ret;
+}
+
+// a no-op once `co_event_listener` has been called
+void co_fd_unwatch(co_scheduler_t *co_scheduler, int fd, co_event_listener_t *co_event_listener) {
+    if (fd < 0 || fd >= co_scheduler->co_fds_size || !co_scheduler->co_fds[fd]) return;
+
+    co_fd_t *co_fd = co_scheduler->co_fds[fd];
+    if (co_fd->reader == co_event_listener) co_fd->reader = 0;
+    else if (co_fd->writer == co_event_listener) co_fd->writer = 0;
+    else if (co_fd->error == co_event_listener) co_fd->error = 0;
+    else return;
+    co_fd_update(co_fd);
+}
+
+// the destructor is published together with the key, so co_destroy
+// never sees a key whose destructor is not there yet
+int co_local_key_create(void (*destructor)(void *)) {
+    if (!destructor) destructor = co_local_keep;
+
+    for (int key = 0; key < CO_LOCAL_SLOTS; key++) {
+        void (*unused)(void *) = 0;
+        if (__atomic_compare_exchange_n(&co_local_destructors[key], &unused, destructor,
+                                        0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return key;
+    }
+    return -1;
+}
+
+int64_t co_clock_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
 
 co_scheduler_t *co_scheduler_init(co_scheduler_t *co_scheduler, void (*uinit)(int, int)) {
     co_scheduler->co_running = 1;
+    co_scheduler->co_epoll_flags = 0;
+    co_scheduler->co_busy_poll_us = 0;
+
+    for (int i = 0; i < CO_PRIORITY_LEVELS; i++) {
+        list_init(&co_scheduler->co_ready[i]);
+        pheap_init(&co_scheduler->co_edf_ready[i], co_edf_less);
+    }
+    co_scheduler->co_overrun_hook = 0;
+    co_scheduler->co_edf = 0;
+    pheap_init(&co_scheduler->co_deadlines, co_deadline_less);
+    co_scheduler->co_deadline_timer_us = 0;
+    co_scheduler->co_fds = 0;
+    co_scheduler->co_fds_size = 0;
+    co_scheduler->co_shed = 0;
+    slab_init(&co_scheduler->co_routine_slab, sizeof(co_routine_t), CO_ROUTINE_SLAB);
+    slab_init(&co_scheduler->co_object_slab, CO_OBJECT_SIZE, CO_OBJECT_SLAB);
 
     co_scheduler->epollfd = epoll_create1(EPOLL_CLOEXEC);
     if (co_scheduler->epollfd == -1)
         goto error_epoll_create;
 
+    co_scheduler->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (co_scheduler->wakefd == -1)
+        goto error_wakefd;
+
+    co_scheduler->co_wake_listener.callback = co_scheduler_wakefd_callback;
+    list_init(&co_scheduler->co_deferred);
+    list_init(&co_scheduler->co_attached);
+    struct epoll_event read_event;
+    read_event.events = EPOLLIN;
+    read_event.data.ptr = &co_scheduler->co_wake_listener;
+    int ret = epoll_ctl(co_scheduler->epollfd, EPOLL_CTL_ADD, co_scheduler->wakefd, &read_event);
+    if (ret == -1)
+        goto error_wake_callback;
+
+    co_scheduler->deadline_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (co_scheduler->deadline_timerfd == -1)
+        goto error_wake_callback;
+
+    co_scheduler->co_deadline_listener.callback = co_scheduler_deadline_callback;
+    read_event.events = EPOLLIN;
+    read_event.data.ptr = &co_scheduler->co_deadline_listener;
+    ret = epoll_ctl(co_scheduler->epollfd, EPOLL_CTL_ADD, co_scheduler->deadline_timerfd, &read_event);
+    if (ret == -1)
+        goto error_deadline_callback;
+
     getcontext(&co_scheduler->ctx_origin);
     getcontext(&co_scheduler->co_kloopd.co_context);
     co_scheduler->co_kloopd.co_context.uc_link = &co_scheduler->ctx_origin;
@@ -100,6 +717,7 @@ co_scheduler_t *co_scheduler_init(co_scheduler_t *co_scheduler, void (*uinit)(in
     int ptr_low_bits = (uintptr_t)(&co_scheduler->co_kloopd) << 32 >> 32;
     makecontext(&co_scheduler->co_kloopd.co_context, (void (*)(void))kloopd, 2, ptr_high_bits, ptr_low_bits);
     co_scheduler->co_kloopd.co_scheduler = co_scheduler;
+    memset(co_scheduler->co_kloopd.co_locals, 0, sizeof(co_scheduler->co_kloopd.co_locals));
 
     if (!co_init(&co_scheduler->co_uinit, co_scheduler, uinit))
         goto error_init_init;
@@ -108,36 +726,130 @@ co_scheduler_t *co_scheduler_init(co_scheduler_t *co_scheduler, void (*uinit)(in
 
 
 error_init_init:
+error_deadline_callback:
+    close(co_scheduler->deadline_timerfd);
+error_wake_callback:
+    close(co_scheduler->wakefd);
+error_wakefd:
     close(co_scheduler->epollfd);
 error_epoll_create:
     return 0;
 }
 
 void co_scheduler_run(co_scheduler_t *co_scheduler) {
+    slab_adopt(&co_scheduler->co_routine_slab);
+    slab_adopt(&co_scheduler->co_object_slab);
+    for (list_t *node = list_get_head(&co_scheduler->co_attached); node != &co_scheduler->co_attached; node = node->next) {
+        co_attached_t *co_attached = container_of(node, co_attached_t, node);
+        co_attached->adopt(co_attached);
+    }
+
+    co_current_routine = &co_scheduler->co_kloopd;
     swapcontext(&co_scheduler->ctx_origin, &co_scheduler->co_kloopd.co_context);
+    co_current_routine = 0;
+
+    co_scheduler_destroy(co_scheduler);
+}
+
+// safe to call from any thread
+void co_scheduler_exit(co_scheduler_t *co_scheduler) {
+    __atomic_store_n(&co_scheduler->co_running, 0, __ATOMIC_RELEASE);
+
+    uint64_t count = 1;
+    write(co_scheduler->wakefd, &count, sizeof(count));
+}
 
+// co_scheduler_run does this itself, only needed for a scheduler never run
+void co_scheduler_destroy(co_scheduler_t *co_scheduler) {
     co_destroy(&co_scheduler->co_uinit);
+    for (int i = 0; i < CO_PRIORITY_LEVELS; i++)
+        list_destroy(&co_scheduler->co_ready[i]);
+    list_destroy(&co_scheduler->co_deferred);
+    list_destroy(&co_scheduler->co_attached);
+    slab_destroy(&co_scheduler->co_routine_slab);
+    slab_destroy(&co_scheduler->co_object_slab);
+    free(co_scheduler->co_fds);
+    close(co_scheduler->deadline_timerfd);
+    close(co_scheduler->wakefd);
     close(co_scheduler->epollfd);
 }
 
-void co_scheduler_exit(co_scheduler_t *co_scheduler) {
-    co_scheduler->co_running = 0;
+// every fd kloopd watches is drained completely by its callback or dispatch,
+// so either mode is safe, edge-triggered saves the re-reporting of fds
+// that are still readable; co_routines and co_cvs created before the switch
+// keep the mode they were registered with
+int co_scheduler_set_edge_triggered(co_scheduler_t *co_scheduler, int edge_triggered) {
+    co_scheduler->co_epoll_flags = edge_triggered ? EPOLLET : 0;
+
+    struct epoll_event read_event;
+    read_event.events = EPOLLIN | co_scheduler->co_epoll_flags;
+    read_event.data.ptr = &co_scheduler->co_wake_listener;
+    if (epoll_ctl(co_scheduler->epollfd, EPOLL_CTL_MOD, co_scheduler->wakefd, &read_event) == -1)
+        return errno;
+
+    read_event.data.ptr = &co_scheduler->co_deadline_listener;
+    if (epoll_ctl(co_scheduler->epollfd, EPOLL_CTL_MOD, co_scheduler->deadline_timerfd, &read_event) == -1)
+        return errno;
+
+    read_event.data.ptr = &co_scheduler->co_uinit.co_event_listener;
+    if (epoll_ctl(co_scheduler->epollfd, EPOLL_CTL_MOD, co_scheduler->co_uinit.eventfd, &read_event) == -1)
+        return errno;
+
+    return 0;
+}
+
+void co_scheduler_set_busy_poll(co_scheduler_t *co_scheduler, int64_t busy_poll_us) {
+    co_scheduler->co_busy_poll_us = busy_poll_us > 0 ? busy_poll_us : 0;
+}
+
+void co_scheduler_set_overrun_hook(co_scheduler_t *co_scheduler, void (*hook)(co_routine_t *, int64_t)) {
+    co_scheduler->co_overrun_hook = hook;
+}
+
+void co_scheduler_set_edf(co_scheduler_t *co_scheduler, int edf) {
+    co_scheduler->co_edf = edf;
+}
+
+// `co_deferred` runs once, deferring it again before that is a no-op
+void co_scheduler_defer(co_scheduler_t *co_scheduler, co_deferred_t *co_deferred) {
+    if (list_empty(&co_deferred->node))
+        list_add_tail(&co_scheduler->co_deferred, &co_deferred->node);
+}
+
+void co_scheduler_undefer(co_deferred_t *co_deferred) {
+    if (!list_empty(&co_deferred->node))
+        list_init(list_del(&co_deferred->node));
+}
+
+// attach before co_scheduler_run, or from the thread already running it,
+// detach before the scheduler is destroyed
+void co_scheduler_attach(co_scheduler_t *co_scheduler, co_attached_t *co_attached) {
+    list_add_tail(&co_scheduler->co_attached, &co_attached->node);
+}
+
+void co_scheduler_detach(co_attached_t *co_attached) {
+    list_del(&co_attached->node);
 }
 
 
 /** BEGIN: unit test **/
 #ifdef __MODULE_COROUTINE__
-// gcc -g -Wall -fsanitize=address -D__MODULE_COROUTINE__ coroutine.c
+// gcc -g -Wall -fsanitize=address -D__MODULE_COROUTINE__ coroutine.c utils/slab.c
 
 #include <stdio.h>
 #include <stdlib.h>
 
+static int key_parent;
+static int sub3_done = 0;
+static int parked_done = 0;
+static co_routine_t *co_urgent;
+static int low_slices = 0;
+
 void sub2(int ptr_high_bits, int ptr_low_bits) {
     printf("[%s] enter\n", __FUNCTION__);
-    co_routine_t *co_sub2 = co_this(ptr_high_bits, ptr_low_bits);
+    co_routine_t *co_sub2 = co_current();
 
-    co_routine_t **env = (co_routine_t **)(co_sub2->co_stack + CO_STACK_SIZE - sizeof(intptr_t));
-    co_routine_t *co_sub1 = *env;
+    co_routine_t *co_sub1 = (co_routine_t *)co_local_get(co_sub2, key_parent);
 
     printf("[%s] co_sub1 addr: %#lX\n", __FUNCTION__, (uintptr_t)co_sub1);
     printf("[%s] co_sub2 addr: %#lX\n", __FUNCTION__, (uintptr_t)co_sub2);
@@ -146,23 +858,165 @@ void sub2(int ptr_high_bits, int ptr_low_bits) {
     printf("[%s] return\n", __FUNCTION__);
 }
 
+void sub3(int ptr_high_bits, int ptr_low_bits) {
+    co_routine_t *co_sub3 = co_this(ptr_high_bits, ptr_low_bits);
+    printf("[%s] enter, priority %d\n", __FUNCTION__, co_sub3->co_priority);
+
+    // burn more than the budget, kloopd should demote us
+    int64_t start_us = co_clock_us();
+    while (co_clock_us() - start_us < 2000);
+    co_resume(co_sub3);
+    co_yield(co_sub3);
+    printf("[%s] demoted to priority %d\n", __FUNCTION__, co_sub3->co_priority);
+
+    // slices within budget earn the priority back
+    for (int i = 0; i < CO_BUDGET_RESTORE; i++) {
+        co_resume(co_sub3);
+        co_yield(co_sub3);
+    }
+    printf("[%s] restored to priority %d\n", __FUNCTION__, co_sub3->co_priority);
+
+    sub3_done = 1;
+    printf("[%s] return\n", __FUNCTION__);
+}
+
+void edf(int ptr_high_bits, int ptr_low_bits) {
+    co_routine_t *co_edf = co_this(ptr_high_bits, ptr_low_bits);
+    printf("[%s] co_routine %#lX deadline in %ld us\n",
+           __FUNCTION__, (uintptr_t)co_edf, co_edf->co_deadline_us - co_clock_us());
+}
+
+void high(int ptr_high_bits, int ptr_low_bits) {
+    printf("[%s] no deadline, still ahead of the normal level\n", __FUNCTION__);
+}
+
+static int reader_fds[2];
+
+// never woken, released while parked on the pipe
+void reader(int ptr_high_bits, int ptr_low_bits) {
+    co_routine_t *co_reader = co_this(ptr_high_bits, ptr_low_bits);
+    co_wait_fd(co_reader, reader_fds[0], EPOLLIN, 0);
+    printf("[%s] should not be here\n", __FUNCTION__);
+}
+
+void parked(int ptr_high_bits, int ptr_low_bits) {
+    co_routine_t *co_parked = co_this(ptr_high_bits, ptr_low_bits);
+
+    // nobody resumes it, kloopd does once the deadline passes
+    int status = co_yield(co_parked);
+    printf("[%s] woken past its deadline, co_yield: %d\n", __FUNCTION__, status);
+
+    // shed only once, the unwinding itself is not interrupted
+    co_resume(co_parked);
+    status = co_yield(co_parked);
+    printf("[%s] unwinding, co_yield: %d\n", __FUNCTION__, status);
+    parked_done = 1;
+}
+
+void urgent(int ptr_high_bits, int ptr_low_bits) {
+    co_yield(co_urgent);
+    printf("[%s] ran after %d low slices\n", __FUNCTION__, low_slices);
+}
+
+// the first low slice wakes co_urgent, which must not wait for the others
+void low(int ptr_high_bits, int ptr_low_bits) {
+    if (low_slices++ == 0) co_resume(co_urgent);
+    int64_t start_us = co_clock_us();
+    while (co_clock_us() - start_us < 1000);
+}
+
+void overrun(co_routine_t *co_routine, int64_t elapsed_us) {
+    printf("[%s] co_routine %#lX ran %ld us, budget %ld us\n",
+           __FUNCTION__, (uintptr_t)co_routine, elapsed_us, co_routine->co_budget_us);
+}
+
 void sub1(int ptr_high_bits, int ptr_low_bits) {
     co_routine_t *co_sub1 = co_this(ptr_high_bits, ptr_low_bits);
     printf("[%s] enter\n", __FUNCTION__);
 
     printf("[%s] co_sub1 addr: %#lX\n", __FUNCTION__, (uintptr_t)co_sub1);
 
-    co_routine_t *co_sub2 = (co_routine_t *)malloc(sizeof(co_routine_t));
-    co_init(co_sub2, co_sub1->co_scheduler, sub2);
+    co_routine_t *co_sub2 = co_create(co_sub1->co_scheduler, sub2);
     printf("[%s] co_sub2 addr: %#lX\n", __FUNCTION__, (uintptr_t)co_sub2);
 
-    co_routine_t **env = (co_routine_t **)(co_sub2->co_stack + CO_STACK_SIZE - sizeof(intptr_t));
-    *env = co_sub1;
+    co_local_set(co_sub2, key_parent, co_sub1);
+
+    // sub3 stays at normal priority, sub2 is dispatched before it
+    co_routine_t *co_sub3 = co_create(co_sub1->co_scheduler, sub3);
+    co_set_priority(co_sub2, CO_PRIORITY_HIGH);
+    co_set_budget(co_sub3, 1000, 1);
+    co_scheduler_set_overrun_hook(co_sub1->co_scheduler, overrun);
+
+    co_yield(co_sub1);
+
+    printf("[%s] co_sub3 overruns: %ld, priority: %d\n", __FUNCTION__, co_sub3->co_overruns, co_sub3->co_priority);
+
+    // dispatched by deadline instead of creation order
+    co_scheduler_set_edf(co_sub1->co_scheduler, 1);
+    co_routine_t *co_edfs[3];
+    for (int i = 0; i < 3; i++) {
+        co_edfs[i] = co_create(co_sub1->co_scheduler, edf);
+        printf("[%s] co_edfs[%d] addr: %#lX\n", __FUNCTION__, i, (uintptr_t)co_edfs[i]);
+    }
+    co_set_deadline(co_edfs[0], co_clock_us() + 200000);
+    co_set_deadline(co_edfs[1], co_clock_us() + 100000);
+    co_set_deadline(co_edfs[2], co_clock_us() - 1);
+    co_routine_t *co_high = co_create(co_sub1->co_scheduler, high);
+    co_set_priority(co_high, CO_PRIORITY_HIGH);
+    co_resume(co_sub1);
+    co_yield(co_sub1);
+    printf("[%s] shed: %ld\n", __FUNCTION__, co_sub1->co_scheduler->co_shed);
+    // expired before it ever ran, fn was not entered
+    printf("[%s] co_edfs[2] done: %d, started: %d\n", __FUNCTION__, co_done(co_edfs[2]), co_edfs[2]->co_started);
+    while (!sub3_done) {
+        co_resume(co_sub1);
+        co_yield(co_sub1);
+    }
+    for (int i = 0; i < 3; i++)
+        co_release(co_edfs[i]);
+    co_release(co_high);
+
+    co_routine_t *co_parked = co_create(co_sub1->co_scheduler, parked);
+    co_set_deadline(co_parked, co_clock_us() + 20000);
+    while (!parked_done) {
+        co_resume(co_sub1);
+        co_yield(co_sub1);
+    }
+    printf("[%s] shed: %ld\n", __FUNCTION__, co_sub1->co_scheduler->co_shed);
+    co_release(co_parked);
 
+    co_urgent = co_create(co_sub1->co_scheduler, urgent);
+    co_set_priority(co_urgent, CO_PRIORITY_HIGH);
+    co_resume(co_sub1);
     co_yield(co_sub1);
+    co_routine_t *co_lows[4];
+    for (int i = 0; i < 4; i++) {
+        co_lows[i] = co_create(co_sub1->co_scheduler, low);
+        co_set_priority(co_lows[i], CO_PRIORITY_LOW);
+    }
+    while (low_slices < 4) {
+        co_resume(co_sub1);
+        co_yield(co_sub1);
+    }
+    for (int i = 0; i < 4; i++)
+        co_release(co_lows[i]);
+    co_release(co_urgent);
 
-    co_destroy(co_sub2);
-    free(co_sub2);
+    // the fd slot does not outlive the waiter on the stack of co_reader
+    pipe(reader_fds);
+    co_routine_t *co_reader = co_create(co_sub1->co_scheduler, reader);
+    co_resume(co_sub1);
+    co_yield(co_sub1);
+    co_release(co_reader);
+    printf("[%s] fd watched after release: %d\n", __FUNCTION__, co_sub1->co_scheduler->co_fds[reader_fds[0]] != 0);
+    write(reader_fds[1], "x", 1);
+    co_resume(co_sub1);
+    co_yield(co_sub1);
+    close(reader_fds[0]);
+    close(reader_fds[1]);
+
+    co_release(co_sub3);
+    co_release(co_sub2);
 
     co_scheduler_exit(co_sub1->co_scheduler);
     printf("[%s] sizeof(co_routine_t) == %lu\n", __FUNCTION__, sizeof(co_routine_t));
@@ -170,8 +1024,18 @@ void sub1(int ptr_high_bits, int ptr_low_bits) {
 }
 
 int main(int argc, char *argv[]) {
+    key_parent = co_local_key_create(0);
+
+    // keys are never reused, -1 once the slots are gone and ignored by the accessors
+    int key;
+    while ((key = co_local_key_create(0)) != -1);
+    co_routine_t co_unused;
+    co_local_set(&co_unused, key, &co_unused);
+    printf("[%s] co_local_get out of range: %p\n", __FUNCTION__, co_local_get(&co_unused, key));
+
     co_scheduler_t *co_scheduler = malloc(sizeof(co_scheduler_t));
     co_scheduler_init(co_scheduler, sub1);
+    co_scheduler_set_busy_poll(co_scheduler, 50);
     co_scheduler_run(co_scheduler);
     free(co_scheduler);
     return 0;
@@ -2,32 +2,162 @@
 #define __HEADER_GLOVE_COROUTINE__
 
 
+#include <stddef.h>
 #include <stdint.h>
 #include <ucontext.h>
 
+#include "utils/list.h"
+#include "utils/pheap.h"
+#include "utils/slab.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 
 #define CO_STACK_SIZE ((128-1) * 1024)
 
+// ready queues, a smaller level is scheduled first
+#define CO_PRIORITY_LEVELS 3
+#define CO_PRIORITY_HIGH   0
+#define CO_PRIORITY_NORMAL 1
+#define CO_PRIORITY_LOW    2
+
+// a demoted co_routine climbs back one level after this many slices within budget
+#define CO_BUDGET_RESTORE 8
+
+// kloopd grows or shrinks the epoll batch between these
+#define CO_EPOLL_BATCH_MIN 16
+#define CO_EPOLL_BATCH_MAX 1024
+
+// co_routines handed out by co_create per malloc
+#define CO_ROUTINE_SLAB 8
+// small runtime objects such as co_cv_waiter_t come from co_object_slab
+#define CO_OBJECT_SIZE  64
+#define CO_OBJECT_SLAB  256
+
+// coroutine-local storage, keys are shared by all schedulers
+// and should be created before any of them runs
+#define CO_LOCAL_SLOTS 16
+
 
 typedef struct __glove_co_event_listener {
     void (*callback)(struct __glove_co_event_listener *);
+    // epoll events of the current dispatch, set by kloopd before callback
+    uint32_t events;
 } co_event_listener_t;
 
 
+// run by kloopd once every callback of an epoll batch is done, for work
+// that may free what later callbacks of the batch still use,
+// `node` must be list_init'ed before the first co_scheduler_defer
+typedef struct __glove_co_deferred {
+    list_t node;
+    void (*callback)(struct __glove_co_deferred *);
+} co_deferred_t;
+
+
+// state a module keeps per scheduler, such as its own slabs, `adopt` is
+// called by co_scheduler_run on the thread about to run the scheduler
+typedef struct __glove_co_attached {
+    list_t node;
+    void (*adopt)(struct __glove_co_attached *);
+} co_attached_t;
+
+
 typedef struct __glove_co_routine {
     int                          eventfd;
     unsigned char                co_stack[CO_STACK_SIZE];
     ucontext_t                   co_context;
     co_event_listener_t          co_event_listener;
     struct __glove_co_scheduler *co_scheduler;
+    // linked into co_scheduler->co_ready[co_priority] while runnable,
+    // or into co_scheduler->co_edf_ready[co_priority] by co_edf_node when co_edf_queued
+    list_t                       co_ready_node;
+    pheap_node_t                 co_edf_node;
+    int                          co_edf_queued;
+    // kloopd pass it was last dispatched in
+    int64_t                      co_pass;
+    int                          co_priority;
+    // set by co_set_priority, co_priority only differs while demoted
+    int                          co_base_priority;
+    // run budget of a single slice, 0 for unlimited
+    int64_t                      co_budget_us;
+    int                          co_budget_demote;
+    // slices within budget since the last overrun
+    int                          co_budget_kept;
+    int64_t                      co_overruns;
+    // absolute CLOCK_MONOTONIC deadline in microseconds, 0 for none,
+    // in co_scheduler->co_deadlines by co_deadline_node until it passes
+    int64_t                      co_deadline_us;
+    pheap_node_t                 co_deadline_node;
+    int                          co_deadline_armed;
+    // returned by co_yield, ETIMEDOUT on the one dispatch that sheds it
+    int                          co_status;
+    // set by co_suspend, still 0 after a dispatch once fn has returned
+    int                          co_suspended;
+    // set while parked in co_wait_fd, co_cv_wait or co_zc_reap, co_destroy calls it
+    // with co_wait to take out whatever still points into the co_routine
+    void                       (*co_wait_cancel)(struct __glove_co_routine *, void *co_wait);
+    void                        *co_wait;
+    // set by the first switch in, a co_routine shed before that never starts
+    int                          co_started;
+    // fn has returned, or was dropped by its deadline before it started
+    int                          co_finished;
+    void                        *co_locals[CO_LOCAL_SLOTS];
 } co_routine_t;
 
+// the single epoll registration of an fd while anyone waits on it, one
+// watcher may wait for EPOLLIN and another one for anything else meanwhile
+typedef struct __glove_co_fd {
+    co_event_listener_t          co_event_listener;
+    int                          fd;
+    int                          registered;
+    uint32_t                     reader_events;
+    uint32_t                     writer_events;
+    co_event_listener_t         *reader;
+    co_event_listener_t         *writer;
+    // drains the error queue, see co_fd_watch_error
+    co_event_listener_t         *error;
+    struct __glove_co_scheduler *co_scheduler;
+} co_fd_t;
+
 typedef struct __glove_co_scheduler {
     int           co_running;
     int           epollfd;
+    // ORed into every epoll registration, EPOLLET in edge-triggered mode
+    uint32_t      co_epoll_flags;
+    // spin on a non-blocking epoll_wait this long before sleeping, 0 for never
+    int64_t       co_busy_poll_us;
+    // written by co_scheduler_exit to break out of epoll_wait at once
+    int           wakefd;
+    co_event_listener_t co_wake_listener;
+    list_t        co_deferred;
+    // see co_scheduler_attach
+    list_t        co_attached;
     ucontext_t    ctx_origin;
     co_routine_t  co_kloopd;
     co_routine_t  co_uinit;
+    list_t        co_ready[CO_PRIORITY_LEVELS];
+    // earliest deadline first within each level, only used when `co_edf` is set
+    int           co_edf;
+    pheap_t       co_edf_ready[CO_PRIORITY_LEVELS];
+    // every pending deadline, deadline_timerfd fires for the earliest one
+    pheap_t       co_deadlines;
+    int           deadline_timerfd;
+    int64_t       co_deadline_timer_us;
+    co_event_listener_t co_deadline_listener;
+    // indexed by fd, see co_fd_watch
+    co_fd_t     **co_fds;
+    int           co_fds_size;
+    int64_t       co_shed;
+    // called from kloopd when a slice exceeds its budget
+    void        (*co_overrun_hook)(co_routine_t *, int64_t elapsed_us);
+    // owned by the thread running kloopd, release everything taken
+    // from them before the scheduler itself is released
+    slab_t        co_routine_slab;
+    slab_t        co_object_slab;
 } co_scheduler_t;
 
 
@@ -46,16 +176,81 @@ static inline co_routine_t *co_this(int ptr_high_bits, int ptr_low_bits) {
     return (co_routine_t *)ptr;
 }
 
+// the co_routine running on this thread, updated by kloopd on every switch,
+// it is co_kloopd itself inside event callbacks
+extern __thread co_routine_t *co_current_routine;
+
+static inline co_routine_t *co_current(void) {
+    return co_current_routine;
+}
+
+static inline int co_done(co_routine_t *co_routine) {
+    return co_routine->co_finished;
+}
+
+// a key outside the slots, such as the -1 of a failed co_local_key_create,
+// reads as 0 and is never written
+static inline void *co_local_get(co_routine_t *co_routine, int key) {
+    if ((unsigned)key >= CO_LOCAL_SLOTS) return 0;
+    return co_routine->co_locals[key];
+}
+
+static inline void co_local_set(co_routine_t *co_routine, int key, void *value) {
+    if ((unsigned)key >= CO_LOCAL_SLOTS) return;
+    co_routine->co_locals[key] = value;
+}
+
 
 co_routine_t *co_init(co_routine_t *co_routine, co_scheduler_t *co_scheduler, void (*fn)(int, int));
+co_routine_t *co_init_reserve(co_routine_t *co_routine, co_scheduler_t *co_scheduler, void (*fn)(int, int), size_t reserve);
 void co_destroy(co_routine_t *co_routine);
+co_routine_t *co_create(co_scheduler_t *co_scheduler, void (*fn)(int, int));
+co_routine_t *co_create_reserve(co_scheduler_t *co_scheduler, void (*fn)(int, int), size_t reserve);
+void co_release(co_routine_t *co_routine);
 void co_resume(co_routine_t *swap_in);
-void co_yield(co_routine_t *swap_out);
+int co_suspend(co_routine_t *swap_out);
+void co_set_priority(co_routine_t *co_routine, int priority);
+void co_set_budget(co_routine_t *co_routine, int64_t budget_us, int demote);
+void co_set_deadline(co_routine_t *co_routine, int64_t deadline_us);
+int64_t co_clock_us(void);
+int co_wait_fd(co_routine_t *co_routine, int fd, uint32_t events, uint32_t *revents);
+int co_fd_watch(co_scheduler_t *co_scheduler, int fd, uint32_t events, co_event_listener_t *co_event_listener);
+int co_fd_watch_error(co_scheduler_t *co_scheduler, int fd, co_event_listener_t *co_event_listener);
+void co_fd_unwatch(co_scheduler_t *co_scheduler, int fd, co_event_listener_t *co_event_listener);
+int co_local_key_create(void (*destructor)(void *));
+
+// `co_yield` is a keyword since C++20, C++ code calls co_suspend instead
+#ifndef __cplusplus
+static inline int co_yield(co_routine_t *swap_out) {
+    return co_suspend(swap_out);
+}
+#endif
+
+// bytes kept by co_init_reserve at the top of co_stack, out of reach of the stack,
+// the address is 16 byte aligned, co_stack itself is not
+static inline void *co_stack_reserved(co_routine_t *co_routine, size_t reserve) {
+    uintptr_t reserved = (uintptr_t)(co_routine->co_stack + CO_STACK_SIZE - reserve);
+    return (void *)(reserved & ~(uintptr_t)15);
+}
 
 
 co_scheduler_t *co_scheduler_init(co_scheduler_t *co_scheduler, void (*uinit)(int, int));
 void co_scheduler_run(co_scheduler_t *co_scheduler);
 void co_scheduler_exit(co_scheduler_t *co_scheduler);
+void co_scheduler_destroy(co_scheduler_t *co_scheduler);
+int co_scheduler_set_edge_triggered(co_scheduler_t *co_scheduler, int edge_triggered);
+void co_scheduler_set_busy_poll(co_scheduler_t *co_scheduler, int64_t busy_poll_us);
+void co_scheduler_set_overrun_hook(co_scheduler_t *co_scheduler, void (*hook)(co_routine_t *, int64_t));
+void co_scheduler_set_edf(co_scheduler_t *co_scheduler, int edf);
+void co_scheduler_defer(co_scheduler_t *co_scheduler, co_deferred_t *co_deferred);
+void co_scheduler_undefer(co_deferred_t *co_deferred);
+void co_scheduler_attach(co_scheduler_t *co_scheduler, co_attached_t *co_attached);
+void co_scheduler_detach(co_attached_t *co_attached);
+
+
+#ifdef __cplusplus
+}
+#endif
 
 
 #endif
\ No newline at end of file
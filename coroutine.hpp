@@ -0,0 +1,319 @@
+#ifndef __HEADER_GLOVE_COROUTINE_HPP__
+#define __HEADER_GLOVE_COROUTINE_HPP__
+
+
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <sys/epoll.h>
+
+#include "coroutine.h"
+#include "cocv.h"
+
+
+// C++20 layer over coroutine.h and cocv.h
+//
+// stackful side: glove::scheduler and glove::routine run arbitrary callables,
+// a routine keeps its callable in place at the top of its own co_stack
+//
+// stackless side: glove::task is a detached C++20 coroutine, it may
+// `co_await` a glove::cv or fd readiness and is resumed from kloopd after
+// each epoll batch, so it must never call co_suspend or anything that does
+namespace glove {
+
+
+inline co_routine_t *current() {
+    return co_current();
+}
+
+// park the running stackful co_routine until co_resume, see co_suspend
+inline int suspend() {
+    return co_suspend(co_current());
+}
+
+inline int wait_fd(int fd, uint32_t events, uint32_t *revents = nullptr) {
+    return co_wait_fd(co_current(), fd, events, revents);
+}
+
+
+class scheduler {
+public:
+    // `fn` runs as co_uinit
+    template <class F>
+    explicit scheduler(F &&fn) : state_(new state) {
+        using fn_t = std::decay_t<F>;
+        state_->fn = new fn_t(std::forward<F>(fn));
+        state_->invoke = [](void *fn) { (*static_cast<fn_t *>(fn))(); };
+        state_->destroy = [](void *fn) { delete static_cast<fn_t *>(fn); };
+
+        if (!co_scheduler_init(&state_->co_scheduler, uinit)) {
+            int error = errno;
+            state_->destroy(state_->fn);
+            delete state_;
+            throw std::system_error(error, std::system_category(), "co_scheduler_init");
+        }
+    }
+
+    ~scheduler() {
+        // a scheduler that ran was released by co_scheduler_run already
+        if (!ran_) co_scheduler_destroy(&state_->co_scheduler);
+        state_->destroy(state_->fn);
+        delete state_;
+    }
+
+    scheduler(const scheduler &) = delete;
+    scheduler &operator=(const scheduler &) = delete;
+
+    void run() {
+        ran_ = true;
+        co_scheduler_run(&state_->co_scheduler);
+    }
+
+    void exit() { co_scheduler_exit(&state_->co_scheduler); }
+
+    co_scheduler_t *get() { return &state_->co_scheduler; }
+
+private:
+    struct state {
+        // first member, uinit casts back from it
+        co_scheduler_t co_scheduler;
+        void          *fn;
+        void         (*invoke)(void *);
+        void         (*destroy)(void *);
+    };
+    static_assert(std::is_standard_layout_v<state>, "state is reached from its first member");
+
+    static void uinit(int ptr_high_bits, int ptr_low_bits) noexcept {
+        co_routine_t *co_uinit = co_this(ptr_high_bits, ptr_low_bits);
+        state *self = reinterpret_cast<state *>(co_uinit->co_scheduler);
+        self->invoke(self->fn);
+    }
+
+    state *state_;
+    bool   ran_ = false;
+};
+
+
+class routine {
+public:
+    // the callable is moved into the top of co_stack, nothing is allocated for it
+    template <class F>
+    routine(co_scheduler_t *co_scheduler, F &&fn) {
+        using frame_t = frame<std::decay_t<F>>;
+        static_assert(sizeof(frame_t) < CO_STACK_SIZE / 4, "captures too large for the co_stack");
+        static_assert(alignof(frame_t) <= 16, "co_stack_reserved only aligns to 16");
+
+        co_routine_ = co_create_reserve(co_scheduler, entry<std::decay_t<F>>, sizeof(frame_t));
+        if (!co_routine_)
+            throw std::system_error(errno ? errno : ENOMEM, std::system_category(), "co_create_reserve");
+        // co_routine_ is only queued so far, it first runs from kloopd,
+        // so it is released before it ever sees a frame that failed to construct
+        try {
+            frame_ = ::new (co_stack_reserved(co_routine_, sizeof(frame_t))) frame_t(std::forward<F>(fn));
+        } catch (...) {
+            co_release(co_routine_);
+            throw;
+        }
+    }
+
+    template <class F>
+    routine(scheduler &sched, F &&fn) : routine(sched.get(), std::forward<F>(fn)) {}
+
+    // a co_routine destroyed while suspended does not unwind its stack,
+    // only the callable itself is destroyed here, a co_wait_fd or co_cv_wait
+    // it is parked in is cancelled by co_release, any other wait must be
+    // over before, see done()
+    ~routine() {
+        if (frame_->alive) frame_->destroy(frame_);
+        co_release(co_routine_);
+    }
+
+    routine(const routine &) = delete;
+    routine &operator=(const routine &) = delete;
+
+    void resume() { co_resume(co_routine_); }
+    void set_priority(int priority) { co_set_priority(co_routine_, priority); }
+    void set_budget(int64_t budget_us, bool demote) { co_set_budget(co_routine_, budget_us, demote); }
+    void set_deadline(int64_t deadline_us) { co_set_deadline(co_routine_, deadline_us); }
+    // shed by its deadline before it started, the callable never ran
+    bool done() const { return !frame_->alive || co_done(co_routine_); }
+
+    co_routine_t *get() { return co_routine_; }
+
+private:
+    struct frame_base {
+        bool alive = true;
+        void (*destroy)(frame_base *);
+    };
+
+    template <class F>
+    struct frame : frame_base {
+        template <class G>
+        explicit frame(G &&g) : fn(std::forward<G>(g)) {
+            destroy = [](frame_base *self) {
+                static_cast<frame *>(self)->~frame();
+                self->alive = false;
+            };
+        }
+        F fn;
+    };
+
+    template <class F>
+    static void entry(int ptr_high_bits, int ptr_low_bits) noexcept {
+        co_routine_t *co_routine = co_this(ptr_high_bits, ptr_low_bits);
+        auto *self = static_cast<frame<F> *>(co_stack_reserved(co_routine, sizeof(frame<F>)));
+        self->fn();
+        self->destroy(self);
+    }
+
+    co_routine_t *co_routine_;
+    frame_base   *frame_;
+};
+
+
+// fire and forget C++20 coroutine, its frame is freed once it returns
+struct task {
+    struct promise_type {
+        task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+
+namespace detail {
+
+// woken from a kloopd callback, but the stackless coroutine is only resumed
+// once the epoll batch is done, it may destroy what the batch still uses
+struct waker {
+    co_event_listener_t     co_event_listener;
+    co_deferred_t           co_deferred;
+    co_scheduler_t         *co_scheduler;
+    std::coroutine_handle<> handle;
+
+    explicit waker(co_scheduler_t *co_scheduler) : co_scheduler(co_scheduler) {
+        co_event_listener.callback = wake;
+        co_event_listener.events = 0;
+        list_init(&co_deferred.node);
+        co_deferred.callback = run;
+    }
+    ~waker() { co_scheduler_undefer(&co_deferred); }
+
+    waker(const waker &) = delete;
+    waker &operator=(const waker &) = delete;
+
+    static void wake(co_event_listener_t *co_event_listener) {
+        waker *self = reinterpret_cast<waker *>(co_event_listener);
+        co_scheduler_defer(self->co_scheduler, &self->co_deferred);
+    }
+
+    static void run(co_deferred_t *co_deferred) {
+        container_of(co_deferred, waker, co_deferred)->handle.resume();
+    }
+};
+static_assert(std::is_standard_layout_v<waker>, "waker is reached from its first member");
+
+}
+
+
+class cv {
+public:
+    explicit cv(co_scheduler_t *co_scheduler) {
+        if (!co_cv_init(&co_cv_, co_scheduler))
+            throw std::system_error(errno, std::system_category(), "co_cv_init");
+    }
+    explicit cv(scheduler &sched) : cv(sched.get()) {}
+    ~cv() { co_cv_destroy(&co_cv_); }
+
+    cv(const cv &) = delete;
+    cv &operator=(const cv &) = delete;
+
+    // from a stackful routine, same return values as co_cv_wait
+    int wait(int64_t wait_ms = -1) { return co_cv_wait(&co_cv_, co_current(), wait_ms); }
+    void signal(int64_t n = 1) { co_cv_signal(&co_cv_, n); }
+
+    // from a glove::task
+    class awaiter {
+    public:
+        explicit awaiter(co_cv_t *co_cv) : co_cv_(co_cv), waker_(co_cv->co_scheduler) {
+            list_init(&co_cv_waiter_.node);
+        }
+        ~awaiter() { co_cv_cancel(&co_cv_waiter_); }
+
+        awaiter(const awaiter &) = delete;
+        awaiter &operator=(const awaiter &) = delete;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) noexcept {
+            waker_.handle = handle;
+            co_cv_wait_listener(co_cv_, &co_cv_waiter_, &waker_.co_event_listener);
+        }
+        void await_resume() const noexcept {}
+
+    private:
+        co_cv_t        *co_cv_;
+        co_cv_waiter_t  co_cv_waiter_;
+        detail::waker   waker_;
+    };
+
+    awaiter operator co_await() { return awaiter(&co_cv_); }
+
+    co_cv_t *get() { return &co_cv_; }
+
+private:
+    co_cv_t co_cv_;
+};
+
+
+// `co_await glove::readable(sched, fd)` inside a glove::task,
+// yields the epoll events, EPOLLERR if fd could not be watched,
+// EBUSY included, when another waiter has the same direction of fd
+class fd_awaiter {
+public:
+    fd_awaiter(co_scheduler_t *co_scheduler, int fd, uint32_t events)
+        : co_scheduler_(co_scheduler), fd_(fd), events_(events), waker_(co_scheduler) {}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        waker_.handle = handle;
+
+        // shares the registration of fd with stackful waiters, see co_fd_watch
+        if (co_fd_watch(co_scheduler_, fd_, events_, &waker_.co_event_listener)) {
+            waker_.co_event_listener.events = EPOLLERR;
+            return false;
+        }
+        return true;
+    }
+    uint32_t await_resume() noexcept {
+        co_fd_unwatch(co_scheduler_, fd_, &waker_.co_event_listener);
+        return waker_.co_event_listener.events;
+    }
+
+private:
+    co_scheduler_t *co_scheduler_;
+    int             fd_;
+    uint32_t        events_;
+    detail::waker   waker_;
+};
+
+inline fd_awaiter readable(co_scheduler_t *co_scheduler, int fd) {
+    return fd_awaiter(co_scheduler, fd, EPOLLIN);
+}
+
+inline fd_awaiter writable(co_scheduler_t *co_scheduler, int fd) {
+    return fd_awaiter(co_scheduler, fd, EPOLLOUT);
+}
+
+
+}
+
+
+#endif
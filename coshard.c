@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "coshard.h"
+
+
+static void co_shard_eventfd_callback(co_event_listener_t *co_event_listener) {
+    co_shard_t *co_shard = container_of(co_event_listener, co_shard_t, co_event_listener);
+
+    uint64_t count;
+    read(co_shard->eventfd, &count, sizeof(count));
+
+    // take the whole mailbox, handlers are free to send again
+    squeue_t received;
+    squeue_init(&received);
+    pthread_mutex_lock(&co_shard->mailbox_lock);
+    squeue_splice(&received, &co_shard->mailbox);
+    pthread_mutex_unlock(&co_shard->mailbox_lock);
+
+    squeue_node_t *node;
+    while ((node = squeue_pop(&received))) {
+        co_shard_msg_t *co_shard_msg = container_of(node, co_shard_msg_t, node);
+        co_shard_msg->handler(co_shard_msg, co_shard);
+    }
+}
+
+static void co_shard_exit_handler(co_shard_msg_t *co_shard_msg, co_shard_t *co_shard) {
+    co_scheduler_exit(&co_shard->co_scheduler);
+}
+
+static int co_shard_listen(co_shard_t *co_shard, const struct sockaddr *addr, socklen_t addrlen) {
+    co_shard->listenfd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (co_shard->listenfd == -1) goto error_socket;
+
+    int on = 1;
+    if (setsockopt(co_shard->listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1)
+        goto error_setsockopt;
+    // every shard binds the same address, the kernel balances accepts among them
+    if (setsockopt(co_shard->listenfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1)
+        goto error_setsockopt;
+    // a hint only, not every kernel honours it for listening sockets
+    setsockopt(co_shard->listenfd, SOL_SOCKET, SO_INCOMING_CPU, &co_shard->cpu, sizeof(co_shard->cpu));
+
+    if (bind(co_shard->listenfd, addr, addrlen) == -1) goto error_setsockopt;
+    if (listen(co_shard->listenfd, SOMAXCONN) == -1) goto error_setsockopt;
+
+    return 0;
+
+
+error_setsockopt:
+    close(co_shard->listenfd);
+    co_shard->listenfd = -1;
+error_socket:
+    return errno;
+}
+
+static co_shard_t *co_shard_init(co_shards_t *co_shards, int index, int cpu) {
+    // the calling thread is already pinned to `cpu`, so by first touch
+    // the shard, stacks included, ends up on the NUMA node of that cpu
+    co_shard_t *co_shard;
+    if (posix_memalign((void **)&co_shard, 64, sizeof(co_shard_t)))
+        goto error_malloc;
+
+    co_shard->index = index;
+    co_shard->cpu = cpu;
+    co_shard->listenfd = -1;
+    co_shard->co_shards = co_shards;
+
+    if (co_shards->addr && co_shard_listen(co_shard, co_shards->addr, co_shards->addrlen))
+        goto error_listen;
+
+    co_shard->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (co_shard->eventfd == -1) goto error_eventfd;
+
+    pthread_mutex_init(&co_shard->mailbox_lock, 0);
+    squeue_init(&co_shard->mailbox);
+    co_shard->co_event_listener.callback = co_shard_eventfd_callback;
+    co_shard->exit_msg.handler = co_shard_exit_handler;
+
+    if (!co_scheduler_init(&co_shard->co_scheduler, co_shards->uinit))
+        goto error_scheduler_init;
+
+    struct epoll_event read_event;
+    read_event.events = EPOLLIN | co_shard->co_scheduler.co_epoll_flags;
+    read_event.data.ptr = &co_shard->co_event_listener;
+    int ret = epoll_ctl(co_shard->co_scheduler.epollfd, EPOLL_CTL_ADD, co_shard->eventfd, &read_event);
+    if (ret == -1) goto error_event_callback;
+
+    return co_shard;
+
+
+error_event_callback:
+    co_scheduler_destroy(&co_shard->co_scheduler);
+error_scheduler_init:
+    pthread_mutex_destroy(&co_shard->mailbox_lock);
+    close(co_shard->eventfd);
+error_eventfd:
+    if (co_shard->listenfd != -1) close(co_shard->listenfd);
+error_listen:
+    free(co_shard);
+error_malloc:
+    return 0;
+}
+
+static void co_shard_destroy(co_shard_t *co_shard) {
+    pthread_mutex_destroy(&co_shard->mailbox_lock);
+    close(co_shard->eventfd);
+    if (co_shard->listenfd != -1) close(co_shard->listenfd);
+    free(co_shard);
+}
+
+typedef struct __glove_co_shard_arg {
+    co_shards_t *co_shards;
+    int          index;
+    int          cpu;
+} co_shard_arg_t;
+
+static void *co_shard_thread(void *arg) {
+    co_shard_arg_t *co_shard_arg = (co_shard_arg_t *)arg;
+    co_shards_t *co_shards = co_shard_arg->co_shards;
+    int index = co_shard_arg->index;
+    int cpu = co_shard_arg->cpu;
+    free(co_shard_arg);
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    int error = 0;
+    co_shard_t *co_shard = 0;
+    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == -1)
+        error = errno;
+    else if (!(co_shard = co_shard_init(co_shards, index, cpu)))
+        error = errno ? errno : ENOMEM;
+
+    // every shard is reachable through co_shard_send once all are ready
+    pthread_mutex_lock(&co_shards->lock);
+    co_shards->shards[index] = co_shard;
+    if (error) co_shards->error = error;
+    if (--co_shards->pending == 0)
+        pthread_cond_broadcast(&co_shards->cond);
+    while (co_shards->pending > 0)
+        pthread_cond_wait(&co_shards->cond, &co_shards->lock);
+    error = co_shards->error;
+    pthread_mutex_unlock(&co_shards->lock);
+
+    // some shard failed, co_shards_init tears down the others
+    if (error) return 0;
+
+    co_scheduler_run(&co_shard->co_scheduler);
+    return 0;
+}
+
+
+co_shards_t *co_shards_init(co_shards_t *co_shards, int nshards, void (*uinit)(int, int),
+                            const struct sockaddr *addr, socklen_t addrlen) {
+    // one shard per cpu this process may run on
+    cpu_set_t cpu_set;
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == -1)
+        goto error_affinity;
+    int ncpus = CPU_COUNT(&cpu_set);
+    if (nshards <= 0 || nshards > ncpus) nshards = ncpus;
+
+    co_shards->nshards = nshards;
+    co_shards->error = 0;
+    co_shards->exiting = 0;
+    co_shards->uinit = uinit;
+    co_shards->addr = addr;
+    co_shards->addrlen = addrlen;
+
+    co_shards->shards = (co_shard_t **)calloc(nshards, sizeof(co_shard_t *));
+    co_shards->threads = (pthread_t *)calloc(nshards, sizeof(pthread_t));
+    if (!co_shards->shards || !co_shards->threads)
+        goto error_malloc;
+
+    pthread_mutex_init(&co_shards->lock, 0);
+    pthread_cond_init(&co_shards->cond, 0);
+    co_shards->pending = nshards;
+
+    int started = 0;
+    for (int cpu = 0; started < nshards; cpu++) {
+        if (!CPU_ISSET(cpu, &cpu_set)) continue;
+
+        co_shard_arg_t *co_shard_arg = (co_shard_arg_t *)malloc(sizeof(co_shard_arg_t));
+        if (co_shard_arg) {
+            co_shard_arg->co_shards = co_shards;
+            co_shard_arg->index = started;
+            co_shard_arg->cpu = cpu;
+        }
+        if (!co_shard_arg || pthread_create(&co_shards->threads[started], 0, co_shard_thread, co_shard_arg)) {
+            free(co_shard_arg);
+            // release the shards already started
+            pthread_mutex_lock(&co_shards->lock);
+            co_shards->error = EAGAIN;
+            co_shards->pending -= nshards - started;
+            if (co_shards->pending == 0)
+                pthread_cond_broadcast(&co_shards->cond);
+            pthread_mutex_unlock(&co_shards->lock);
+            break;
+        }
+        started++;
+    }
+
+    pthread_mutex_lock(&co_shards->lock);
+    while (co_shards->pending > 0)
+        pthread_cond_wait(&co_shards->cond, &co_shards->lock);
+    pthread_mutex_unlock(&co_shards->lock);
+
+    if (co_shards->error) {
+        for (int i = 0; i < started; i++)
+            pthread_join(co_shards->threads[i], 0);
+        goto error_shard_init;
+    }
+
+    return co_shards;
+
+
+error_shard_init:
+    for (int i = 0; i < started; i++) {
+        co_shard_t *co_shard = co_shards->shards[i];
+        if (!co_shard) continue;
+        co_scheduler_destroy(&co_shard->co_scheduler);
+        co_shard_destroy(co_shard);
+    }
+    pthread_cond_destroy(&co_shards->cond);
+    pthread_mutex_destroy(&co_shards->lock);
+error_malloc:
+    free(co_shards->shards);
+    free(co_shards->threads);
+error_affinity:
+    return 0;
+}
+
+// safe to call from any thread, and more than once
+void co_shards_exit(co_shards_t *co_shards) {
+    if (__atomic_exchange_n(&co_shards->exiting, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    for (int i = 0; i < co_shards->nshards; i++)
+        co_shard_send(co_shards->shards[i], &co_shards->shards[i]->exit_msg);
+}
+
+void co_shards_join(co_shards_t *co_shards) {
+    for (int i = 0; i < co_shards->nshards; i++)
+        pthread_join(co_shards->threads[i], 0);
+    // no shard is running now, so none can be sent to any more
+    for (int i = 0; i < co_shards->nshards; i++)
+        co_shard_destroy(co_shards->shards[i]);
+    pthread_cond_destroy(&co_shards->cond);
+    pthread_mutex_destroy(&co_shards->lock);
+    free(co_shards->shards);
+    free(co_shards->threads);
+}
+
+void co_shard_send(co_shard_t *co_shard, co_shard_msg_t *co_shard_msg) {
+    pthread_mutex_lock(&co_shard->mailbox_lock);
+    squeue_push(&co_shard->mailbox, &co_shard_msg->node);
+    pthread_mutex_unlock(&co_shard->mailbox_lock);
+
+    uint64_t count = 1;
+    write(co_shard->eventfd, &count, sizeof(count));
+}
+
+
+/** BEGIN: unit test **/
+#ifdef __MODULE_COSHARD__
+// gcc -g -Wall -fsanitize=address -D__MODULE_COSHARD__ coshard.c coroutine.c utils/slab.c -lpthread
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define SHARD_PORT 18086
+#define SHARD_CONNS 16
+
+static int accepted = 0;
+
+typedef struct __glove_hello {
+    co_shard_msg_t co_shard_msg;
+    int            from;
+} hello_t;
+
+void hello(co_shard_msg_t *co_shard_msg, co_shard_t *co_shard) {
+    hello_t *msg = container_of(co_shard_msg, hello_t, co_shard_msg);
+    printf("[%s] shard %d on cpu %d got hello from shard %d\n", __FUNCTION__, co_shard->index, co_shard->cpu, msg->from);
+    free(msg);
+}
+
+void init(int ptr_high_bits, int ptr_low_bits) {
+    co_routine_t *co_uinit = co_this(ptr_high_bits, ptr_low_bits);
+    co_shard_t *co_shard = co_shard_this(co_uinit);
+    co_shards_t *co_shards = co_shard->co_shards;
+
+    hello_t *msg = (hello_t *)malloc(sizeof(hello_t));
+    msg->co_shard_msg.handler = hello;
+    msg->from = co_shard->index;
+    co_shard_send(co_shards->shards[(co_shard->index + 1) % co_shards->nshards], &msg->co_shard_msg);
+
+    while (1) {
+        uint32_t revents;
+        if (co_wait_fd(co_uinit, co_shard->listenfd, EPOLLIN, &revents)) break;
+
+        int fd;
+        while ((fd = accept4(co_shard->listenfd, 0, 0, SOCK_CLOEXEC)) != -1) {
+            close(fd);
+            printf("[%s] shard %d accepted a connection\n", __FUNCTION__, co_shard->index);
+            if (__atomic_add_fetch(&accepted, 1, __ATOMIC_RELAXED) == SHARD_CONNS) {
+                co_shards_exit(co_shards);
+                // a second call, from any shard, sends nothing
+                co_shards_exit(co_shards);
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(SHARD_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    co_shards_t co_shards;
+    if (!co_shards_init(&co_shards, 0, init, (struct sockaddr *)&addr, sizeof(addr))) {
+        printf("[%s] co_shards_init failed\n", __FUNCTION__);
+        return 1;
+    }
+    printf("[%s] %d shards running\n", __FUNCTION__, co_shards.nshards);
+
+    for (int i = 0; i < SHARD_CONNS; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+        close(fd);
+    }
+
+    co_shards_join(&co_shards);
+    printf("[%s] accepted: %d\n", __FUNCTION__, accepted);
+    return 0;
+}
+
+#endif
+/** END: unit test **/
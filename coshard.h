@@ -0,0 +1,74 @@
+#ifndef __HEADER_GLOVE_COSHARD__
+#define __HEADER_GLOVE_COSHARD__
+
+
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "coroutine.h"
+#include "utils/squeue.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct __glove_co_shard;
+
+typedef struct __glove_co_shard_msg {
+    squeue_node_t node;
+    // runs inside kloopd of the receiving shard, must not block
+    void (*handler)(struct __glove_co_shard_msg *, struct __glove_co_shard *);
+} co_shard_msg_t;
+
+typedef struct __glove_co_shard {
+    int                       index;
+    int                       cpu;
+    // bound with SO_REUSEPORT, -1 when the shards do not listen
+    int                       listenfd;
+    // mailbox, written by any thread, drained by the owning kloopd
+    int                       eventfd;
+    pthread_mutex_t           mailbox_lock;
+    squeue_t                  mailbox;
+    co_event_listener_t       co_event_listener;
+    co_shard_msg_t            exit_msg;
+    struct __glove_co_shards *co_shards;
+    co_scheduler_t            co_scheduler;
+} co_shard_t;
+
+typedef struct __glove_co_shards {
+    int                    nshards;
+    co_shard_t           **shards;
+    pthread_t             *threads;
+    // shards still starting up, co_shards_init waits until it is 0
+    pthread_mutex_t        lock;
+    pthread_cond_t         cond;
+    int                    pending;
+    int                    error;
+    // set by the first co_shards_exit, exit_msg may only be queued once
+    int                    exiting;
+    void                 (*uinit)(int, int);
+    const struct sockaddr *addr;
+    socklen_t              addrlen;
+} co_shards_t;
+
+
+co_shards_t *co_shards_init(co_shards_t *co_shards, int nshards, void (*uinit)(int, int),
+                            const struct sockaddr *addr, socklen_t addrlen);
+void co_shards_exit(co_shards_t *co_shards);
+void co_shards_join(co_shards_t *co_shards);
+
+static inline co_shard_t *co_shard_this(co_routine_t *co_routine) {
+    return container_of(co_routine->co_scheduler, co_shard_t, co_scheduler);
+}
+
+void co_shard_send(co_shard_t *co_shard, co_shard_msg_t *co_shard_msg);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
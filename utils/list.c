@@ -1,36 +1,7 @@
 #include "list.h"
 
 
-list_t *list_init(list_t *list) {
-    list->prev = list;
-    list->next = list;
-    return list;
-}
-
-void list_destroy(list_t *list) {
-}
-
-int list_empty(list_t *list) {
-    return list->next == list;
-}
-
-list_t *list_add_tail(list_t *list, list_t *node) {
-    node->next = list;
-    node->prev = list->prev;
-    list->prev->next = node;
-    list->prev = node;
-    return node;
-}
-
-list_t *list_get_head(list_t *list) {
-    return list->next;
-}
-
-list_t *list_del(list_t *node) {
-    node->prev->next = node->next;
-    node->next->prev = node->prev;
-    return node;
-}
+// every list operation is inlined in list.h
 
 
 /** BEGIN: unit test **/
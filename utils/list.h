@@ -5,18 +5,52 @@
 #include <stdint.h>
 
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
 typedef struct __glove_list {
     struct __glove_list *prev;
     struct __glove_list *next;
 } list_t;
 
 
-list_t *list_init(list_t *list);
-void list_destroy(list_t *list);
-int list_empty(list_t *list);
-list_t *list_add_tail(list_t *list, list_t *node);
-list_t *list_get_head(list_t *list);
-list_t *list_del(list_t *node);
+static inline list_t *list_init(list_t *list) {
+    list->prev = list;
+    list->next = list;
+    return list;
+}
+
+static inline void list_destroy(list_t *list) {
+}
+
+static inline int list_empty(list_t *list) {
+    return list->next == list;
+}
+
+static inline list_t *list_add_tail(list_t *list, list_t *node) {
+    node->next = list;
+    node->prev = list->prev;
+    list->prev->next = node;
+    list->prev = node;
+    return node;
+}
+
+static inline list_t *list_get_head(list_t *list) {
+    return list->next;
+}
+
+static inline list_t *list_del(list_t *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    return node;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,47 @@
+#include "pheap.h"
+
+
+// every pheap operation is inlined in pheap.h
+
+
+/** BEGIN: unit test **/
+#ifdef __MODULE_UTILS_PHEAP__
+// gcc -g -Wall -fsanitize=address -D__MODULE_UTILS_PHEAP__ pheap.c
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct __glove_data {
+    pheap_node_t node;
+    int key;
+} data_t;
+
+static int data_less(pheap_node_t *a, pheap_node_t *b) {
+    return ((data_t *)a)->key < ((data_t *)b)->key;
+}
+
+int main(int argc, char *argv[]) {
+    pheap_t pheap;
+    pheap_init(&pheap, data_less);
+
+    data_t datas[20];
+    for (int i = 0; i < 20; i++) {
+        datas[i].key = (i * 7) % 20;
+        pheap_insert(&pheap, &datas[i].node);
+    }
+
+    // keys 0, 7 and 14 are removed from the middle
+    pheap_remove(&pheap, &datas[0].node);
+    pheap_remove(&pheap, &datas[1].node);
+    pheap_remove(&pheap, &datas[2].node);
+
+    pheap_node_t *node;
+    while ((node = pheap_pop(&pheap)))
+        printf("%d ", ((data_t *)node)->key);
+    printf("\n");
+
+    return 0;
+}
+
+#endif
+/** END: unit test **/
\ No newline at end of file
@@ -0,0 +1,129 @@
+#ifndef __HEADER_GLOVE_PHEAP__
+#define __HEADER_GLOVE_PHEAP__
+
+
+#include <stddef.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// intrusive pairing heap, O(1) insert, amortized O(log n) pop and remove
+typedef struct __glove_pheap_node {
+    struct __glove_pheap_node *child;
+    struct __glove_pheap_node *next;
+    // parent for a first child, left sibling otherwise, 0 for the root
+    struct __glove_pheap_node *prev;
+} pheap_node_t;
+
+// returns non zero when `a` must be popped before `b`
+typedef int (*pheap_less_t)(pheap_node_t *a, pheap_node_t *b);
+
+typedef struct __glove_pheap {
+    pheap_node_t *root;
+    pheap_less_t  less;
+} pheap_t;
+
+
+static inline pheap_t *pheap_init(pheap_t *pheap, pheap_less_t less) {
+    pheap->root = 0;
+    pheap->less = less;
+    return pheap;
+}
+
+static inline int pheap_empty(pheap_t *pheap) {
+    return pheap->root == 0;
+}
+
+static inline pheap_node_t *pheap_top(pheap_t *pheap) {
+    return pheap->root;
+}
+
+static inline pheap_node_t *pheap_meld(pheap_t *pheap, pheap_node_t *a, pheap_node_t *b) {
+    if (!a) return b;
+    if (!b) return a;
+
+    // `a` stays on top on ties
+    if (pheap->less(b, a)) {
+        pheap_node_t *t = a;
+        a = b;
+        b = t;
+    }
+
+    b->prev = a;
+    b->next = a->child;
+    if (a->child) a->child->prev = b;
+    a->child = b;
+    a->next = 0;
+    a->prev = 0;
+    return a;
+}
+
+// two pass pairing of a sibling list
+static inline pheap_node_t *pheap_merge_pairs(pheap_t *pheap, pheap_node_t *first) {
+    pheap_node_t *pairs = 0;
+    while (first) {
+        pheap_node_t *a = first;
+        pheap_node_t *b = a->next;
+        first = b ? b->next : 0;
+
+        a->next = a->prev = 0;
+        if (b) b->next = b->prev = 0;
+
+        // push the pair onto a reversed list, linked through `next`
+        pheap_node_t *pair = pheap_meld(pheap, a, b);
+        pair->next = pairs;
+        pairs = pair;
+    }
+
+    pheap_node_t *root = 0;
+    while (pairs) {
+        pheap_node_t *pair = pairs;
+        pairs = pairs->next;
+        pair->next = 0;
+        root = pheap_meld(pheap, root, pair);
+    }
+    return root;
+}
+
+static inline void pheap_insert(pheap_t *pheap, pheap_node_t *node) {
+    node->child = node->next = node->prev = 0;
+    pheap->root = pheap_meld(pheap, pheap->root, node);
+}
+
+static inline pheap_node_t *pheap_pop(pheap_t *pheap) {
+    pheap_node_t *root = pheap->root;
+    if (!root) return 0;
+
+    pheap->root = pheap_merge_pairs(pheap, root->child);
+    root->child = 0;
+    return root;
+}
+
+// `node` must be in `pheap`
+static inline void pheap_remove(pheap_t *pheap, pheap_node_t *node) {
+    if (node == pheap->root) {
+        pheap_pop(pheap);
+        return;
+    }
+
+    // cut the subtree out of its sibling list
+    if (node->prev->child == node) node->prev->child = node->next;
+    else node->prev->next = node->next;
+    if (node->next) node->next->prev = node->prev;
+    node->next = node->prev = 0;
+
+    pheap_node_t *rest = pheap_merge_pairs(pheap, node->child);
+    node->child = 0;
+    pheap->root = pheap_meld(pheap, pheap->root, rest);
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include "ring.h"
+
+
+// every ring operation is inlined in ring.h
+
+
+/** BEGIN: unit test **/
+#ifdef __MODULE_UTILS_RING__
+// gcc -g -Wall -fsanitize=address -D__MODULE_UTILS_RING__ ring.c
+
+#include <stdio.h>
+
+int main(int argc, char *argv[]) {
+    void *slots[8];
+    int values[12];
+    ring_t ring;
+    ring_init(&ring, slots, 8);
+
+    // wraps around twice, pushes past the capacity are refused
+    int refused = 0;
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 12; i++) {
+            values[i] = round * 100 + i;
+            if (!ring_push(&ring, &values[i])) refused++;
+        }
+        while (!ring_empty(&ring))
+            printf("%d ", *(int *)ring_pop(&ring));
+        printf("\n");
+    }
+    printf("refused: %d\n", refused);
+
+    return 0;
+}
+
+#endif
+/** END: unit test **/
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef __HEADER_GLOVE_RING__
+#define __HEADER_GLOVE_RING__
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// bounded FIFO of pointers over caller provided storage,
+// the capacity must be a power of two; single threaded
+typedef struct __glove_ring {
+    void   **slots;
+    uint32_t mask;
+    uint32_t head;
+    uint32_t tail;
+} ring_t;
+
+
+static inline ring_t *ring_init(ring_t *ring, void **slots, uint32_t capacity) {
+    if (!capacity || (capacity & (capacity - 1))) return 0;
+
+    ring->slots = slots;
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    return ring;
+}
+
+static inline uint32_t ring_size(ring_t *ring) {
+    return ring->tail - ring->head;
+}
+
+static inline int ring_empty(ring_t *ring) {
+    return ring->tail == ring->head;
+}
+
+static inline int ring_full(ring_t *ring) {
+    return ring_size(ring) > ring->mask;
+}
+
+// returns 0 when the ring is full
+static inline int ring_push(ring_t *ring, void *item) {
+    if (ring_full(ring)) return 0;
+    ring->slots[ring->tail++ & ring->mask] = item;
+    return 1;
+}
+
+static inline void *ring_pop(ring_t *ring) {
+    if (ring_empty(ring)) return 0;
+    return ring->slots[ring->head++ & ring->mask];
+}
+
+static inline void *ring_peek(ring_t *ring) {
+    if (ring_empty(ring)) return 0;
+    return ring->slots[ring->head & ring->mask];
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
\ No newline at end of file
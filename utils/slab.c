@@ -0,0 +1,106 @@
+#include <stdlib.h>
+
+#include "slab.h"
+
+
+__thread char slab_thread_token;
+
+
+slab_t *slab_init(slab_t *slab, size_t size, size_t per_chunk) {
+    // every object can hold the free list link and stays 16 bytes aligned
+    if (size < sizeof(slab_object_t)) size = sizeof(slab_object_t);
+    slab->size = (size + 15) & ~(size_t)15;
+    slab->per_chunk = per_chunk ? per_chunk : 1;
+    slab->local = 0;
+    slab->remote = 0;
+    list_init(&slab->chunks);
+    slab_adopt(slab);
+    return slab;
+}
+
+// objects still in use are released together with their chunks
+void slab_destroy(slab_t *slab) {
+    while (!list_empty(&slab->chunks))
+        free(list_del(list_get_head(&slab->chunks)));
+    list_destroy(&slab->chunks);
+    slab->local = 0;
+    slab->remote = 0;
+}
+
+void *slab_alloc_slow(slab_t *slab) {
+    // take everything other threads gave back at once, the owner never
+    // pops single objects off `remote`, so there is no ABA to care about
+    slab->local = __atomic_exchange_n(&slab->remote, 0, __ATOMIC_ACQUIRE);
+    if (slab->local) return slab_alloc(slab);
+
+    // the chunk header is a list_t, objects follow it 16 bytes aligned
+    const size_t head = (sizeof(list_t) + 15) & ~(size_t)15;
+    unsigned char *chunk = (unsigned char *)malloc(head + slab->per_chunk * slab->size);
+    if (!chunk) return 0;
+
+    list_add_tail(&slab->chunks, (list_t *)chunk);
+    for (size_t i = slab->per_chunk; i > 0; i--) {
+        slab_object_t *object = (slab_object_t *)(chunk + head + (i - 1) * slab->size);
+        object->next = slab->local;
+        slab->local = object;
+    }
+    return slab_alloc(slab);
+}
+
+void slab_free_remote(slab_t *slab, void *object) {
+    slab_object_t *free_object = (slab_object_t *)object;
+    free_object->next = __atomic_load_n(&slab->remote, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&slab->remote, &free_object->next, free_object,
+                                        1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+/** BEGIN: unit test **/
+#ifdef __MODULE_UTILS_SLAB__
+// gcc -g -Wall -fsanitize=address -D__MODULE_UTILS_SLAB__ slab.c -lpthread
+
+#include <stdio.h>
+#include <pthread.h>
+
+#define SLAB_OBJECTS 1000
+
+static slab_t slab;
+static void *objects[SLAB_OBJECTS];
+
+void *release(void *arg) {
+    // not the owner, every free goes through `remote`
+    for (int i = 0; i < SLAB_OBJECTS; i += 2)
+        slab_free(&slab, objects[i]);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    slab_init(&slab, 24, 64);
+
+    for (int i = 0; i < SLAB_OBJECTS; i++) {
+        objects[i] = slab_alloc(&slab);
+        *(int *)objects[i] = i;
+    }
+    int chunks = 0;
+    for (list_t *node = list_get_head(&slab.chunks); node != &slab.chunks; node = node->next) chunks++;
+    printf("object size %lu, chunks %d\n", slab.size, chunks);
+
+    pthread_t thread;
+    pthread_create(&thread, 0, release, 0);
+    for (int i = 1; i < SLAB_OBJECTS; i += 2)
+        slab_free(&slab, objects[i]);
+    pthread_join(thread, 0);
+
+    // everything freed comes back before any new chunk
+    for (int i = 0; i < SLAB_OBJECTS; i++)
+        objects[i] = slab_alloc(&slab);
+    chunks = 0;
+    for (list_t *node = list_get_head(&slab.chunks); node != &slab.chunks; node = node->next) chunks++;
+    printf("after reuse, chunks %d\n", chunks);
+
+    slab_destroy(&slab);
+    return 0;
+}
+
+#endif
+/** END: unit test **/
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef __HEADER_GLOVE_SLAB__
+#define __HEADER_GLOVE_SLAB__
+
+
+#include <stddef.h>
+
+#include "list.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// fixed size object allocator owned by one thread,
+// other threads give objects back through `remote` without locks
+typedef struct __glove_slab_object {
+    struct __glove_slab_object *next;
+} slab_object_t;
+
+typedef struct __glove_slab {
+    size_t         size;
+    size_t         per_chunk;
+    slab_object_t *local;
+    slab_object_t *remote;
+    list_t         chunks;
+    // identifies the owning thread, see slab_adopt
+    const void    *owner;
+} slab_t;
+
+
+extern __thread char slab_thread_token;
+
+
+slab_t *slab_init(slab_t *slab, size_t size, size_t per_chunk);
+void slab_destroy(slab_t *slab);
+void *slab_alloc_slow(slab_t *slab);
+void slab_free_remote(slab_t *slab, void *object);
+
+// the calling thread becomes the owner
+static inline void slab_adopt(slab_t *slab) {
+    slab->owner = &slab_thread_token;
+}
+
+static inline void *slab_alloc(slab_t *slab) {
+    slab_object_t *object = slab->local;
+    if (!object) return slab_alloc_slow(slab);
+
+    slab->local = object->next;
+    return object;
+}
+
+// safe from any thread, only the owner takes the fast path
+static inline void slab_free(slab_t *slab, void *object) {
+    if (slab->owner != &slab_thread_token) {
+        slab_free_remote(slab, object);
+        return;
+    }
+
+    slab_object_t *free_object = (slab_object_t *)object;
+    free_object->next = slab->local;
+    slab->local = free_object;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+#include "squeue.h"
+
+
+// every squeue operation is inlined in squeue.h
+
+
+/** BEGIN: unit test **/
+#ifdef __MODULE_UTILS_SQUEUE__
+// gcc -g -Wall -fsanitize=address -D__MODULE_UTILS_SQUEUE__ squeue.c
+
+#include <stdio.h>
+
+typedef struct __glove_data {
+    squeue_node_t node;
+    int key;
+} data_t;
+
+int main(int argc, char *argv[]) {
+    squeue_t first, second;
+    squeue_init(&first);
+    squeue_init(&second);
+
+    data_t datas[10];
+    for (int i = 0; i < 10; i++) {
+        datas[i].key = i;
+        squeue_push(i < 5 ? &first : &second, &datas[i].node);
+    }
+    squeue_splice(&first, &second);
+
+    printf("second empty: %d, first: ", squeue_empty(&second));
+    squeue_node_t *node;
+    while ((node = squeue_pop(&first)))
+        printf("%d ", ((data_t *)node)->key);
+    printf("\n");
+
+    return 0;
+}
+
+#endif
+/** END: unit test **/
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef __HEADER_GLOVE_SQUEUE__
+#define __HEADER_GLOVE_SQUEUE__
+
+
+#include <stddef.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// intrusive singly linked FIFO, O(1) push, pop and splice, no removal from the middle
+typedef struct __glove_squeue_node {
+    struct __glove_squeue_node *next;
+} squeue_node_t;
+
+typedef struct __glove_squeue {
+    squeue_node_t  *head;
+    squeue_node_t **tail;
+} squeue_t;
+
+
+static inline squeue_t *squeue_init(squeue_t *squeue) {
+    squeue->head = 0;
+    squeue->tail = &squeue->head;
+    return squeue;
+}
+
+static inline int squeue_empty(squeue_t *squeue) {
+    return squeue->head == 0;
+}
+
+static inline void squeue_push(squeue_t *squeue, squeue_node_t *node) {
+    node->next = 0;
+    *squeue->tail = node;
+    squeue->tail = &node->next;
+}
+
+static inline squeue_node_t *squeue_pop(squeue_t *squeue) {
+    squeue_node_t *node = squeue->head;
+    if (!node) return 0;
+
+    squeue->head = node->next;
+    if (!squeue->head) squeue->tail = &squeue->head;
+    return node;
+}
+
+// move every node of `from` to the tail of `to`
+static inline void squeue_splice(squeue_t *to, squeue_t *from) {
+    if (!from->head) return;
+
+    *to->tail = from->head;
+    to->tail = from->tail;
+    squeue_init(from);
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
\ No newline at end of file